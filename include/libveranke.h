@@ -0,0 +1,156 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBVERANKE_H
+
+#define LIBVERANKE_H
+
+/*
+ * A C interface to Veranke, for hosts in other languages. Nothing here
+ * needs a C++ compiler, but libveranke is written in C++, so a C program
+ * must link the C++ runtime too, e.g., cc host.c libveranke.a -lstdc++
+ * -lm with GCC. CMake targets that link libveranke get it automatically,
+ * and a shared libveranke carries it as a dependency of its own.
+ *
+ * Calls that run machines work in whole frames, or in whole batches of
+ * machines, so a host pays one foreign call per frame or per batch rather
+ * than one per instruction.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Interpreter cores, as Veranke::Core.
+ */
+enum {
+  VERANKE_CORE_SWITCH,
+  VERANKE_CORE_TABLE,
+  VERANKE_CORE_PREDECODED,
+  VERANKE_CORE_JIT,
+  VERANKE_CORE_FUSED
+};
+
+/*
+ * Quirk profiles, as Veranke::Profile.
+ */
+enum {
+  VERANKE_QUIRKS_MODERN,
+  VERANKE_QUIRKS_COSMAC,
+  VERANKE_QUIRKS_SCHIP
+};
+
+typedef struct veranke veranke;
+
+/*
+ * Create a machine. Returns NULL if core is unknown or memory runs out.
+ */
+veranke * veranke_create(int core, uint64_t seed);
+
+/*
+ * Create a machine with a quirk profile other than the default, modern
+ * one. Returns NULL if core or profile is unknown or memory runs out.
+ */
+veranke * veranke_create_with_quirks(int core, uint64_t seed, int profile);
+
+void veranke_destroy(veranke * machine);
+
+/*
+ * Copy a ROM into memory at 0x200. Returns 0 if it does not fit.
+ */
+int veranke_load(veranke * machine, const uint8_t * rom, size_t size);
+
+/*
+ * Execute up to n instructions without ticking the timers. Returns how
+ * many ran, fewer than n only if the machine halted waiting for a key.
+ */
+size_t veranke_step_n(veranke * machine, size_t n);
+
+/*
+ * Run n 60 Hz frames: each executes up to instructions_per_frame
+ * instructions and then ticks the timers. Returns the instructions
+ * executed.
+ */
+uint64_t veranke_run_frames(veranke * machine, size_t n, size_t instructions_per_frame);
+
+/*
+ * Run n frames on each of count machines. If keys is not NULL it holds
+ * the keypad for every frame of every machine, machine by machine:
+ * keys[i * n + frame]. If executed is not NULL it receives each machine's
+ * instruction count.
+ */
+void veranke_run_frames_batch(veranke * const * machines, size_t count, size_t n, size_t instructions_per_frame, const uint16_t * keys, uint64_t * executed);
+
+/*
+ * Set the keys held down, one bit per key (bit 0 is key 0).
+ */
+void veranke_set_keys(veranke * machine, uint16_t keys);
+
+/*
+ * Whether the machine is halted waiting for a key.
+ */
+int veranke_waiting(const veranke * machine);
+
+uint8_t veranke_sound_timer(const veranke * machine);
+
+/*
+ * The display, valid until the machine is destroyed: 4 bitplanes of 64
+ * rows of two 64-bit words, with bit 63 of a row's first word being its
+ * leftmost pixel. A 64x32 display uses the first word of the first 32
+ * rows of each plane; a 128x64 one uses them all.
+ */
+const uint64_t * veranke_framebuffer(const veranke * machine);
+
+/*
+ * Whether the display is SUPER-CHIP's 128x64 rather than 64x32.
+ */
+int veranke_hires(const veranke * machine);
+
+/*
+ * The size of a saved state, which is the same for every machine built
+ * from the same library.
+ */
+size_t veranke_state_size(void);
+
+/*
+ * Copy the machine's state into the veranke_state_size bytes at state.
+ */
+void veranke_save(const veranke * machine, void * state);
+
+/*
+ * Replace the machine's state with one saved from any machine. Returns 0,
+ * leaving the machine untouched, if state is not one a machine could have
+ * saved, e.g., it is corrupt.
+ */
+int veranke_restore(veranke * machine, const void * state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
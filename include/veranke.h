@@ -26,12 +26,233 @@
 
 #define VERANKE_H
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <type_traits>
 
-class Veranke {
+#include "veranke/profile.h"
+#include "veranke/quirks.h"
+
+class Jit;
+
+/*
+ * What a host needs to show the display: its bitplanes and the resolution
+ * they are drawn at.
+ */
+struct Display {
+  /*
+   * One bitplane, 64 rows of 128 columns, two 64-bit words per row. Bit 63
+   * of a row's first word is column 0, so a row reads left to right from
+   * its most-significant bit. In low resolution (CHIP-8's 64x32) only the
+   * first word of the first 32 rows is used.
+   */
+  typedef std::array<std::array<std::uint64_t, 2>, 64> Plane;
+
+  /*
+   * The number of bitplanes. CHIP-8 and SUPER-CHIP programs only draw to
+   * the first; XO-CHIP programs choose with Fn01.
+   */
+  static const std::size_t PLANES = 4;
+
+  std::size_t width(void) const {
+    return hires ? 128 : 64;
+  }
+
+  std::size_t height(void) const {
+    return hires ? 64 : 32;
+  }
+
+  /*
+   * The colour of the pixel at column x, row y: bit p is set if it is lit
+   * in plane p.
+   */
+  std::uint8_t pixel(std::size_t x, std::size_t y) const {
+    std::uint8_t color = 0;
+
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      color |= (std::uint8_t) (((video_memory[plane][y][x >> 6] >> (63 - (x & 63))) & 1) << plane);
+    }
+
+    return color;
+  }
+
+  std::array<Plane, PLANES> video_memory;
+
+  /*
+   * Set by HIGH (00FF) for SUPER-CHIP's 128x64 display, cleared by LOW
+   * (00FE).
+   */
+  bool hires;
+};
+
+/*
+ * Everything a CHIP-8 program can observe or change, in one trivially
+ * copyable block, so a machine can be saved and restored with a memcpy.
+ */
+struct MachineState : Display {
+  /*
+   * The keys held down, one bit per key (bit 0 is key 0). SKP, SKNP, and
+   * LD Vx, K all read it; the host writes it.
+   */
+  std::uint16_t keypad;
+
+  /*
+   * XO-CHIP's 64K; CHIP-8 and SUPER-CHIP programs use the first 4K.
+   */
+  std::array<std::uint8_t, 0x10000> memory;
+
+  /*
+   * Rows of the display changed since the host last presented it, in any
+   * plane, one bit per row. Only instructions that draw, clear, scroll, or
+   * change the resolution set bits; the host clears them with presented.
+   */
+  std::uint64_t damage;
+
+  /*
+   * The bitplanes DRW, CLS, and the scrolls act on, one bit per plane.
+   */
+  std::uint8_t planes;
+
+  /*
+   * Set while LD Vx, K has halted the machine to wait for a key. The
+   * timers still need ticking; nothing else changes until a key is down.
+   */
+  bool waiting;
+
+  std::uint8_t delay_timer;
+
+  std::array<std::uint8_t, 16> registers;
+
+  std::uint16_t index;
+
+  std::uint16_t program_counter;
+
+  std::uint8_t sound_timer;
+
+  std::uint8_t stack_pointer;
+
+  std::array<std::uint16_t, 16> stack;
+
+  /*
+   * SUPER-CHIP's RPL user flags, saved and loaded by Fx75 and Fx85.
+   */
+  std::array<std::uint8_t, 16> flags;
+
+  /*
+   * XO-CHIP's audio: a 128-bit, 1-bit-per-sample waveform, most
+   * significant bit first, played while the sound timer runs at
+   * 4000 * 2^((pitch - 64) / 48) bits per second. The defaults play a
+   * 500 Hz square wave, the buzzer CHIP-8 programs expect.
+   */
+  std::array<std::uint8_t, 16> pattern;
+
+  std::uint8_t pitch;
+
+  /*
+   * The xorshift64* generator behind RND Vx, byte. Never zero.
+   */
+  std::uint64_t random_state;
+};
+
+static_assert(std::is_trivially_copyable<MachineState>::value, "MachineState must be trivially copyable");
+
+class Veranke : public MachineState {
 public:
-  Veranke(): delay_timer(0), index(0), program_counter(0x200), sound_timer(0), stack_pointer(0) {
+  /*
+   * Interpreter cores.
+   *
+   * SWITCH decodes every instruction through the nested switch in
+   * decode_and_execute. TABLE indexes a 64K-entry handler table with the
+   * whole opcode, so each instruction costs one load and one indirect
+   * call instead of two levels of unpredictable branches. PREDECODED
+   * executes from a cache of decoded operations that parallels the first
+   * 4K of memory, where CHIP-8 and SUPER-CHIP programs run, and is rebuilt
+   * lazily, one entry at a time, after memory is written; code past it is
+   * decoded afresh each time. JIT translates basic blocks in the first 4K
+   * into native code (see veranke/jit.h) and falls back to PREDECODED
+   * elsewhere and where that is not supported. FUSED is PREDECODED plus
+   * superinstructions: common sequences of two or three instructions are
+   * decoded into a single operation.
+   */
+  enum Core {
+    SWITCH,
+    TABLE,
+    PREDECODED,
+    JIT,
+    FUSED
+  };
+
+  /*
+   * Quirk profiles (see veranke/quirks.h). The core is compiled once per
+   * profile, so the choice costs nothing per instruction.
+   */
+  enum Profile {
+    MODERN,
+    COSMAC,
+    SCHIP
+  };
+
+  /*
+   * The superinstructions built by the FUSED core.
+   *
+   * LD_ADD is 6xkk followed by 7xkk. LD_I_DRW is Annn followed by Dxyn.
+   * TIMER_POLL is Fx07, 3xkk, 1nnn, the usual wait on the delay timer.
+   * LD_VX_I_ADD_I and ADD_I_LD_VX_I are Fx65 and Fx1E, in either order, as
+   * found in loops that walk I through a table.
+   */
+  enum Fusion {
+    LD_ADD,
+    LD_I_DRW,
+    TIMER_POLL,
+    LD_VX_I_ADD_I,
+    ADD_I_LD_VX_I,
+    FUSIONS
+  };
+
+  /*
+   * Where the 8x10 digits LD HF, Vx points I at are kept, after the 4x5
+   * ones at 0.
+   */
+  static const std::uint16_t LARGE_FONT = 0x50;
+
+  /*
+   * The fields of an opcode, extracted once at decode time.
+   */
+  struct Operands {
+    explicit Operands(std::uint16_t opcode = 0): nnn((std::uint16_t) (opcode & 0x0FFF)), x((std::uint8_t) ((opcode & 0x0F00) >> 0x8)), y((std::uint8_t) ((opcode & 0x00F0) >> 0x4)), n((std::uint8_t) (opcode & 0x000F)), kk((std::uint8_t) (opcode & 0x00FF)) {
+    }
+
+    std::uint16_t nnn;
+
+    std::uint8_t x;
+
+    std::uint8_t y;
+
+    std::uint8_t n;
+
+    std::uint8_t kk;
+  };
+
+  typedef void (*Handler)(Veranke &, const Operands &);
+
+  /*
+   * A decoded instruction: its handler, its operands, and the number of
+   * instructions the handler executes (more than one for a fused
+   * operation, whose later operands are those of the entries that
+   * follow it).
+   */
+  struct Operation {
+    Handler handler;
+
+    Operands operands;
+
+    std::uint8_t length;
+  };
+
+  Veranke(Core core = SWITCH, std::uint64_t seed = 0, Profile profile = MODERN): MachineState(), core(core), profile(profile) {
     std::array<std::uint8_t, 80> fontset = {
       0xF0 ,0x90, 0x90, 0x90, 0xF0, // 0
       0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -51,769 +272,2034 @@ public:
       0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
 
+    /*
+     * 8x10 digits for LD HF, Vx.
+     */
+    std::array<std::uint8_t, 160> large_fontset = {
+      0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+      0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+      0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+      0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+      0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+      0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+      0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+      0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+      0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+      0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+      0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+      0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+      0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+      0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+      0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+      0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    /*
+     * Start from a fully defined state so that two machines running the
+     * same ROM (e.g., one per core) stay bit-for-bit comparable.
+     */
+    keypad = 0;
+
+    memory.fill(0);
+
+    video_memory.fill(Plane());
+
+    hires = false;
+
+    damage = 0;
+
+    planes = 0x1;
+
+    waiting = false;
+
+    delay_timer = 0;
+
+    index = 0;
+
+    program_counter = 0x200;
+
+    sound_timer = 0;
+
+    stack_pointer = 0;
+
+    reseed(seed);
+
+    idling = false;
+
+    fast_forwarded = 0;
+
+    registers.fill(0);
+
+    stack.fill(0);
+
+    flags.fill(0);
+
+    pattern.fill(0xF0);
+
+    pitch = 64;
+
+    fusions.fill(0);
+
     for (size_t i = 0; i < 80; ++i) {
       memory[i] = fontset[i];
     }
+
+    for (size_t i = 0; i < 160; ++i) {
+      memory[LARGE_FONT + i] = large_fontset[i];
+    }
+
+    switch (profile) {
+      case COSMAC: undecoded = &predecode<CosmacQuirks>; break;
+      case SCHIP: undecoded = &predecode<SchipQuirks>; break;
+      default: undecoded = &predecode<ModernQuirks>; break;
+    }
+
+    invalidate();
   }
 
-  std::uint16_t fetch(void) {
-    return memory[program_counter] << 8 | memory[program_counter + 1];
+  /*
+   * Expand the display to one colour per pixel, row by row, width pixels
+   * to a row, for hosts that render pixel by pixel.
+   */
+  std::array<std::uint8_t, 128 * 64> pixels(void) const {
+    std::array<std::uint8_t, 128 * 64> pixels;
+
+    for (std::size_t y = 0; y < height(); ++y) {
+      for (std::size_t x = 0; x < width(); ++x) {
+        pixels[y * width() + x] = pixel(x, y);
+      }
+    }
+
+    return pixels;
   }
 
-  void decode_and_execute(void) {
-    std::uint16_t opcode = fetch();
+  /*
+   * Count the delay and sound timers down by one. Hosts call this at
+   * 60 Hz of emulated time.
+   */
+  void tick(void) {
+    if (delay_timer > 0) {
+      --delay_timer;
+    }
 
-    std::uint16_t x;
-    std::uint16_t y;
+    if (sound_timer > 0) {
+      --sound_timer;
+    }
+  }
 
-    switch (opcode & 0xF000) {
-        case 0x0000:
-          switch (opcode & 0x00FF) {
-            /*
-             * CLS
-             *
-             * Clear the display.
-             */
-            case 0x00E0:
-              video_memory.fill(0);
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * RET
-             *
-             * Return from a subroutine.
-             *
-             * The interpreter sets the program counter to the address at
-             * the top of the stack, then subtracts 1 from the stack
-             * pointer.
-             */
-            case 0x00EE:
-              program_counter = stack[--stack_pointer];
-
-              program_counter = (std::uint16_t) (program_counter + 2);
-
-              break;
-
-            default:
-              break;
-          }
+  /*
+   * Restart RND Vx, byte's sequence. Machines seeded alike draw the same
+   * numbers.
+   */
+  void reseed(std::uint64_t seed) {
+    /*
+     * splitmix64 spreads nearby seeds apart; its output is zero for only
+     * one seed, which is replaced.
+     */
+    std::uint64_t z = seed + 0x9E3779B97F4A7C15ull;
 
-          break;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
 
-        /*
-         * JP addr
-         *
-         * Jump to location nnn.
-         *
-         * The interpreter sets the program counter to nnn.
-         */
-        case 0x1000:
-          program_counter = (uint16_t) (opcode & 0x0FFF);
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
 
-          break;
+    z ^= z >> 31;
 
-        /*
-         * CALL addr
-         *
-         * Call subroutine at nnn.
-         *
-         * The interpreter increments the stack pointer, then puts the
-         * current PC on the top of the stack. The PC is then set to nnn.
-         */
-        case 0x2000: {
-          uint16_t addr = (uint16_t) (opcode & 0x0FFF);
+    random_state = z != 0 ? z : 0x9E3779B97F4A7C15ull;
+  }
 
-          stack[stack_pointer++] = program_counter;
+  /*
+   * Whether the display has changed since it was last presented.
+   */
+  bool changed(void) const {
+    return damage != 0;
+  }
 
-          program_counter = addr;
-        }
+  /*
+   * Called by the host once it has presented the display.
+   */
+  void presented(void) {
+    damage = 0;
+  }
+
+  /*
+   * The machine's live state, e.g., to copy to reset a worker or to keep
+   * as a point to rewind to. It is not a snapshot: it changes as the
+   * machine runs, so copy it to keep it.
+   */
+  const MachineState & state(void) const {
+    return *this;
+  }
 
-          break;
+  /*
+   * Replace the machine's state with one saved earlier, from this or any
+   * other machine. Only decoded operations and translated blocks that
+   * cover bytes of memory that differ are dropped. Returns false, leaving
+   * the machine untouched, if no machine could have saved it: its stack
+   * pointer is past the stack or its generator is zero. Every program
+   * counter is in memory.
+   */
+  bool restore(const MachineState &saved) {
+    static_assert(sizeof(saved.memory) == 0x10000, "memory must cover every program counter");
+
+    if (saved.stack_pointer > saved.stack.size() || saved.random_state == 0) {
+      return false;
+    }
 
-        /*
-         * SE Vx, byte
-         *
-         * Skip next instruction if Vx = kk.
-         *
-         * The interpreter compares register Vx to kk, and if they are
-         * equal, increments the program counter by 2.
-         */
-        case 0x3000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+    /*
+     * Only the first 4K, and the bytes a superinstruction at its end
+     * spans, is ever decoded or translated, so only it is compared: a
+     * block at a time, and byte by byte where a block differs.
+     */
+    static const std::size_t BLOCK = 64;
 
-          uint16_t byte = (uint16_t) (opcode & 0x00FF);
+    std::size_t reach = std::min(decoded.size() + 6, memory.size());
 
-          if (registers[x] == byte) {
-            program_counter += 2;
-          }
+    for (std::size_t block = 0; block < reach; block += BLOCK) {
+      std::size_t end = std::min(block + BLOCK, reach);
+
+      if (std::memcmp(&memory[block], &saved.memory[block], end - block) == 0) {
+        continue;
+      }
 
-          program_counter += 2;
+      for (std::size_t address = block; address < end; ++address) {
+        if (memory[address] != saved.memory[address]) {
+          invalidate(address);
         }
+      }
+    }
 
-          break;
+    /*
+     * The host still shows the display as it last presented it.
+     */
+    std::uint64_t stale = damage;
 
-        /*
-         * SNE Vx, byte
-         *
-         * Skip next instruction if Vx != kk.
-         *
-         * The interpreter compares register Vx to kk, and if they are
-         * not equal, increments the program counter by 2.
-         */
-        case 0x4000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      for (std::size_t row = 0; row < 64; ++row) {
+        stale |= (std::uint64_t) (hires != saved.hires || video_memory[plane][row] != saved.video_memory[plane][row]) << row;
+      }
+    }
 
-          uint16_t byte = (uint16_t) (opcode & 0x00FF);
+    std::memcpy(static_cast<MachineState *>(this), &saved, sizeof(MachineState));
 
-          if (registers[x] != byte) {
-            program_counter += 2;
-          }
+    damage = stale;
 
-          program_counter += 2;
-        }
+    idling = false;
 
-          break;
+    return true;
+  }
 
-        /*
-         * SE Vx, Vy
-         *
-         * Skip next instruction if Vx = Vy.
-         *
-         * The interpreter compares register Vx to register Vy, and if
-         * they are equal, increments the program counter by 2.
-         */
-        case 0x5000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+  std::uint16_t fetch(void) {
+    return (std::uint16_t) (memory[program_counter] << 8 | memory[(std::uint16_t) (program_counter + 1)]);
+  }
 
-          y = (uint16_t) ((opcode & 0x00F0) >> 0x4);
+  /*
+   * Copy a ROM into memory at 0x200. Returns false, leaving memory
+   * untouched, if the ROM does not fit.
+   */
+  bool load(const std::uint8_t * rom, std::size_t size) {
+    if (size > memory.size() - 0x200) {
+      return false;
+    }
 
-          if ((opcode & 0x000F) != 0) {
-            break;
-          }
+    std::copy(rom, rom + size, memory.begin() + 0x200);
 
-          if (registers[x] == registers[y]) {
-            program_counter += 2;
-          }
+    invalidate();
 
-          program_counter += 2;
-        }
+    return true;
+  }
 
-          break;
+  /*
+   * Store a byte in memory and drop any decoded operation that covers it.
+   * Every write to memory after construction must go through here (or be
+   * followed by a call to invalidate) so the PREDECODED core never runs a
+   * stale instruction.
+   */
+  void write(std::size_t address, std::uint8_t value) {
+    memory[address & 0xFFFF] = value;
 
-        /*
-         * LD Vx, byte
-         *
-         * Set Vx = kk.
-         *
-         * The interpreter puts the value kk into register Vx.
-         */
-        case 0x6000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+    invalidate(address & 0xFFFF);
+  }
 
-          uint16_t byte = (uint16_t) (opcode & 0x00FF);
+  /*
+   * Drop the decoded operations and translated blocks that overlap
+   * address: the instruction starting there, the one starting a byte
+   * earlier, and with the FUSED core any superinstruction reaching it.
+   * Only the first 4K, where the cache and the translations live, holds
+   * any.
+   */
+  void invalidate(std::size_t address) {
+    if (address >= decoded.size() + 6) {
+      return;
+    }
 
-          registers[x] = (uint8_t) byte;
+    std::size_t reach = core == FUSED ? 6 : 2;
 
-          program_counter += 2;
+    for (std::size_t i = 0; i < reach && i <= address; ++i) {
+      if (address - i < decoded.size()) {
+        Operation &operation = decoded[address - i];
 
-          break;
-        }
+        operation.handler = undecoded;
 
-        /*
-         * ADD Vx, byte
-         *
-         * Set Vx = Vx + kk.
-         *
-         * Adds the value kk to the value of register Vx, then stores
-         * the result in Vx.
-         */
-        case 0x7000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+        operation.length = 1;
+      }
+    }
 
-          uint16_t byte = (uint16_t) (opcode & 0x00FF);
+    if (translations.jit) {
+      invalidate_translations(address);
+    }
+  }
 
-          registers[x] += byte;
+  void invalidate(void) {
+    Operation operation = {undecoded, Operands(), 1};
 
-          program_counter += 2;
-        }
+    decoded.fill(operation);
 
-          break;
-
-        case 0x8000: {
-          x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-          y = (uint16_t) ((opcode & 0x00F0) >> 0x4);
-
-          switch (opcode & 0x000F) {
-            /*
-             * LD Vx, Vy
-             *
-             * Set Vx = Vy.
-             *
-             * Stores the value of register Vy in register Vx.
-             */
-            case 0x0000:
-              registers[x] = registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * OR Vx, Vy
-             *
-             * Set Vx = Vx OR Vy.
-             *
-             * Performs a bitwise OR on the values of Vx and Vy, then
-             * stores the result in Vx. A bitwise OR compares the
-             * corrseponding bits from two values, and if either bit is
-             * 1, then the same bit in the result is also 1. Otherwise,
-             * it is 0.
-             */
-            case 0x0001:
-              registers[x] = registers[x] | registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * AND Vx, Vy
-             *
-             * Set Vx = Vx AND Vy.
-             *
-             * Performs a bitwise AND on the values of Vx and Vy, then
-             * stores the result in Vx. A bitwise AND compares the
-             * corrseponding bits from two values, and if both bits are
-             * 1, then the same bit in the result is also 1. Otherwise,
-             * it is 0.
-             */
-            case 0x0002:
-              registers[x] = registers[x] & registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * XOR Vx, Vy
-             *
-             * Set Vx = Vx XOR Vy.
-             *
-             * Performs a bitwise exclusive OR on the values of Vx and
-             * Vy, then stores the result in Vx. An exclusive OR
-             * compares the corrseponding bits from two values, and if
-             * the bits are not both the same, then the corresponding
-             * bit in the result is set to 1. Otherwise, it is 0.
-             */
-            case 0x0003:
-              registers[x] = registers[x] ^ registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * ADD Vx, Vy
-             *
-             * Set Vx = Vx + Vy, set VF = carry.
-             *
-             * The values of Vx and Vy are added together. If the result
-             * is greater than 8 bits (i.e., > 255,) VF is set to 1,
-             * otherwise 0. Only the lowest 8 bits of the result are
-             * kept, and stored in Vx.
-             */
-            case 0x0004:
-              if (registers[y] > (0xFF - registers[x])) {
-                registers[0xF] = 1;
-              } else {
-                registers[0xF] = 0;
-              }
-
-              registers[x] += registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * SUB Vx, Vy
-             *
-             * Set Vx = Vx - Vy, set VF = NOT borrow.
-             *
-             * If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is
-             * subtracted from Vx, and the results stored in Vx.
-             */
-            case 0x0005:
-              if (registers[x] > registers[y]) {
-                registers[0xF] = 0x1;
-              } else {
-                registers[0xF] = 0x0;
-              }
-
-              registers[x] = registers[x] - registers[y];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * SHR Vx {, Vy}
-             *
-             * Set Vx = Vx SHR 1.
-             *
-             * If the least-significant bit of Vx is 1, then VF is set
-             * to 1, otherwise 0. Then Vx is divided by 2.
-             */
-            case 0x0006:
-              if (registers[x] & 0x1) {
-                registers[0xF] = 1;
-              } else {
-                registers[0x0] = 0;
-              }
-
-              registers[x] /= 2;
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * SUBN Vx, Vy
-             *
-             * Set Vx = Vy - Vx, set VF = NOT borrow.
-             *
-             * If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is
-             * subtracted from Vy, and the results stored in Vx.
-             */
-            case 0x0007:
-              if (registers[y] > registers[x]) {
-                registers[0xF] = 0x1;
-              } else {
-                registers[0xF] = 0x0;
-              }
-
-              registers[x] = registers[y] - registers[x];
-
-              program_counter += 2;
-
-              break;
-
-            /*
-             * SHL Vx {, Vy}
-             *
-             * Set Vx = Vx SHL 1.
-             *
-             * If the most-significant bit of Vx is 1, then VF is set to
-             * 1, otherwise to 0. Then Vx is multiplied by 2.
-             */
-            case 0x000E:
-              if (registers[x] & 0x80) {
-                registers[0xF] = 1;
-              } else {
-                registers[0xF] = 0;
-              }
-
-              registers[x] *= 2;
-
-              program_counter += 2;
-
-              break;
-
-            default:
-              break;
-          }
-        }
+    if (translations.jit) {
+      invalidate_translations();
+    }
+  }
 
-          break;
+  /*
+   * Fetch, decode, and execute a single instruction with the switch core,
+   * specialized on the current profile.
+   */
+  void decode_and_execute(void) {
+    switch (profile) {
+      case COSMAC: decode_and_execute<CosmacQuirks>(); break;
+      case SCHIP: decode_and_execute<SchipQuirks>(); break;
+      default: decode_and_execute<ModernQuirks>(); break;
+    }
+  }
 
-        /*
-         * SNE Vx, Vy
-         *
-         * Skip next instruction if Vx != Vy.
-         *
-         * The values of Vx and Vy are compared, and if they are not
-         * equal, the program counter is increased by 2.
-         */
-        case 0x9000: {
-          uint16_t x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-          uint16_t y = (uint16_t) ((opcode & 0x00F0) >> 0x4);
+  template <class Q>
+  void decode_and_execute(void) {
+    std::uint16_t opcode = fetch();
+
+    tally();
+
+    Operands operands(opcode);
+
+    switch (opcode & 0xF000) {
+      case 0x0000:
+        switch (opcode & 0x00FF) {
+          case 0x00E0: cls(operands); break;
+          case 0x00EE: ret(operands); break;
+          case 0x00FB: scr(operands); break;
+          case 0x00FC: scl(operands); break;
+          case 0x00FD: exit(operands); break;
+          case 0x00FE: low(operands); break;
+          case 0x00FF: high(operands); break;
+
+          default:
+            if ((opcode & 0xFFF0) == 0x00C0) {
+              scd_nibble(operands);
+            } else if ((opcode & 0xFFF0) == 0x00D0) {
+              scu_nibble(operands);
+            }
 
-          if ((opcode & 0x000F) != 0) {
             break;
-          }
+        }
 
-          if (registers[x] != registers[y]) {
-            program_counter += 2;
-          }
+        break;
+
+      case 0x1000: jp_addr(operands); break;
+      case 0x2000: call_addr(operands); break;
+      case 0x3000: se_vx_byte(operands); break;
+      case 0x4000: sne_vx_byte(operands); break;
 
-          program_counter += 2;
+      case 0x5000:
+        switch (opcode & 0x000F) {
+          case 0x0000: se_vx_vy(operands); break;
+          case 0x0002: ld_i_vx_vy(operands); break;
+          case 0x0003: ld_vx_vy_i(operands); break;
+          default: break;
         }
 
-          break;
+        break;
+
+      case 0x6000: ld_vx_byte(operands); break;
+      case 0x7000: add_vx_byte(operands); break;
+
+      case 0x8000:
+        switch (opcode & 0x000F) {
+          case 0x0000: ld_vx_vy(operands); break;
+          case 0x0001: or_vx_vy<Q>(operands); break;
+          case 0x0002: and_vx_vy<Q>(operands); break;
+          case 0x0003: xor_vx_vy<Q>(operands); break;
+          case 0x0004: add_vx_vy(operands); break;
+          case 0x0005: sub_vx_vy(operands); break;
+          case 0x0006: shr_vx<Q>(operands); break;
+          case 0x0007: subn_vx_vy(operands); break;
+          case 0x000E: shl_vx<Q>(operands); break;
+          default: break;
+        }
 
-        /*
-         * LD I, addr
-         *
-         * Set I = nnn.
-         *
-         * The value of register I is set to nnn.
-         */
-        case 0xA000: {
-          index = (uint16_t) (opcode & 0x0FFF);
+        break;
 
-          program_counter += 2;
+      case 0x9000:
+        if ((opcode & 0x000F) == 0) {
+          sne_vx_vy(operands);
         }
 
-          break;
+        break;
 
-        /*
-         * JP V0, addr
-         *
-         * Jump to location nnn + V0.
-         *
-         * The program counter is set to nnn plus the value of V0.
-         */
-        case 0xB000:
-          program_counter = (uint16_t) ((opcode & 0x0FFF) + registers[0]);
+      case 0xA000: ld_i_addr(operands); break;
+      case 0xB000: jp_v0_addr<Q>(operands); break;
+      case 0xC000: rnd_vx_byte(operands); break;
+      case 0xD000: drw_vx_vy_nibble<Q>(operands); break;
+
+      case 0xE000:
+        switch (opcode & 0x00FF) {
+          case 0x009E: skp_vx(operands); break;
+          case 0x00A1: sknp_vx(operands); break;
+          default: break;
+        }
 
-          break;
+        break;
 
-        /*
-         * RND Vx, byte
-         *
-         * Set Vx = random byte AND kk.
-         *
-         * The interpreter generates a random number from 0 to 255,
-         * which is then ANDed with the value kk. The results are stored
-         * in Vx. See instruction 8xy2 for more information on AND.
-         */
-        case 0xC000: {
-          uint16_t x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+      case 0xF000:
+        switch (opcode & 0x00FF) {
+          case 0x0000:
+            if (opcode == 0xF000) {
+              ld_i_long(operands);
+            }
 
-          uint16_t byte = (uint16_t) (opcode & 0x00FF);
+            break;
+
+          case 0x0001: plane_n(operands); break;
+          case 0x0002:
+            if (opcode == 0xF002) {
+              ld_audio_i(operands);
+            }
 
-          registers[x] = (uint8_t) ((rand() % 255) & byte);
+            break;
 
-          program_counter += 2;
+          case 0x0007: ld_vx_dt(operands); break;
+          case 0x000A: ld_vx_k(operands); break;
+          case 0x0015: ld_dt_vx(operands); break;
+          case 0x0018: ld_st_vx(operands); break;
+          case 0x001E: add_i_vx(operands); break;
+          case 0x0029: ld_f_vx(operands); break;
+          case 0x0030: ld_hf_vx(operands); break;
+          case 0x0033: ld_b_vx(operands); break;
+          case 0x003A: pitch_vx(operands); break;
+          case 0x0055: ld_i_vx<Q>(operands); break;
+          case 0x0065: ld_vx_i<Q>(operands); break;
+          case 0x0075: ld_r_vx(operands); break;
+          case 0x0085: ld_vx_r(operands); break;
+          default: break;
         }
 
-          break;
+        break;
 
-        /*
-         * DRW Vx, Vy, nibble
-         *
-         * Display n-byte sprite starting at memory location I at
-         * (Vx, Vy), set VF = collision.
-         *
-         * The interpreter reads n bytes from memory, starting at the
-         * address stored in I. These bytes are then displayed as
-         * sprites on screen at coordinates (Vx, Vy). Sprites are XORed
-         * onto the existing screen. If this causes any pixels to be
-         * erased, VF is set to 1, otherwise it is set to 0. If the
-         * sprite is positioned so part of it is outside the coordinates
-         * of the display, it wraps around to the opposite side of the
-         * screen. See instruction 8xy3 for more information on XOR, and
-         * section 2.4, Display, for more information on the Chip-8
-         * screen and sprites.
-         */
-        case 0xD000: {
-          x = registers[(opcode & 0x0F00) >> 0x8];
+      default:
+        break;
+    }
+  }
 
-          y = registers[(opcode & 0x00F0) >> 0x4];
+  /*
+   * Execute up to n instructions with the core chosen at construction.
+   * Returns how many ran, which is fewer than n only if LD Vx, K halted
+   * the machine to wait for a key; while it waits and no key is down, run
+   * returns 0 at once.
+   *
+   * Idle loops (a jump to itself, or LD Vx, DT; SE Vx, byte; JP back
+   * while the delay timer is still running) cannot change anything before
+   * run returns, so the rest of the budget is fast-forwarded rather than
+   * interpreted. The machine ends in exactly the state interpreting them
+   * would have left it in.
+   */
+  std::size_t run(std::size_t n) {
+    if (waiting) {
+      if (keypad == 0) {
+        return 0;
+      }
+
+      waiting = false;
+    }
 
-          uint16_t nibble = (uint16_t) (opcode & 0x000F);
+    std::size_t executed = 0;
 
-          uint16_t pixel;
+    while (executed < n && !waiting) {
+      executed += execute(n - executed);
 
-          registers[0xF] = 0;
+      if (idling) {
+        executed += fast_forward(n - executed);
+      }
+    }
 
-          for (size_t i = 0; i < nibble; ++i) {
-            pixel = memory[index + i];
+    return executed;
+  }
 
-            for (size_t j = 0; j < 8; ++j) {
-              if ((pixel & (0x80 >> j)) != 0) {
-                if (video_memory[x + j + ((y + i) * 64)] != 0) {
-                  registers[0xF] = 1;
-                }
+  /*
+   * Map an opcode to its handler. Mirrors the decoding done by the switch
+   * in decode_and_execute; opcodes the switch ignores map to invalid.
+   */
+  template <class Q>
+  static Handler decode(std::uint16_t opcode) {
+    switch (opcode & 0xF000) {
+      case 0x0000:
+        switch (opcode & 0x00FF) {
+          case 0x00E0: return &thunk<&Veranke::cls>;
+          case 0x00EE: return &thunk<&Veranke::ret>;
+          case 0x00FB: return &thunk<&Veranke::scr>;
+          case 0x00FC: return &thunk<&Veranke::scl>;
+          case 0x00FD: return &thunk<&Veranke::exit>;
+          case 0x00FE: return &thunk<&Veranke::low>;
+          case 0x00FF: return &thunk<&Veranke::high>;
+
+          default:
+            if ((opcode & 0xFFF0) == 0x00C0) {
+              return &thunk<&Veranke::scd_nibble>;
+            }
 
-                video_memory[x + j + ((y + i) * 64)] ^= 1;
-              }
+            if ((opcode & 0xFFF0) == 0x00D0) {
+              return &thunk<&Veranke::scu_nibble>;
             }
-          }
 
-          program_counter += 2;
+            return &invalid;
         }
 
-          break;
-
-        case 0xE000:
-          switch (opcode & 0x00FF) {
-            /*
-             * SKP Vx
-             *
-             * Skip next instruction if key with the value of Vx is
-             * pressed.
-             *
-             * Checks the keyboard, and if the key corresponding to the
-             * value of Vx is currently in the down position, PC is
-             * increased by 2.
-             */
-            case 0x009E: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-
-              if (keypad[registers[x]] != 0) {
-                program_counter += 2;
-              }
-
-              program_counter += 2;
-            }
+      case 0x1000: return &thunk<&Veranke::jp_addr>;
+      case 0x2000: return &thunk<&Veranke::call_addr>;
+      case 0x3000: return &thunk<&Veranke::se_vx_byte>;
+      case 0x4000: return &thunk<&Veranke::sne_vx_byte>;
+      case 0x5000:
+        switch (opcode & 0x000F) {
+          case 0x0000: return &thunk<&Veranke::se_vx_vy>;
+          case 0x0002: return &thunk<&Veranke::ld_i_vx_vy>;
+          case 0x0003: return &thunk<&Veranke::ld_vx_vy_i>;
+          default: return &invalid;
+        }
 
-              break;
-
-            /*
-             * SKNP Vx
-             *
-             * Skip next instruction if key with the value of Vx is not
-             * pressed.
-             *
-             * Checks the keyboard, and if the key corresponding to the
-             * value of Vx is currently in the up position, PC is
-             * increased by 2.
-             */
-            case 0x00A1: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-
-              if (keypad[registers[x]] == 0) {
-                program_counter += 2;
-              }
-
-              program_counter += 2;
-            }
+      case 0x6000: return &thunk<&Veranke::ld_vx_byte>;
+      case 0x7000: return &thunk<&Veranke::add_vx_byte>;
+
+      case 0x8000:
+        switch (opcode & 0x000F) {
+          case 0x0000: return &thunk<&Veranke::ld_vx_vy>;
+          case 0x0001: return &thunk<&Veranke::or_vx_vy<Q> >;
+          case 0x0002: return &thunk<&Veranke::and_vx_vy<Q> >;
+          case 0x0003: return &thunk<&Veranke::xor_vx_vy<Q> >;
+          case 0x0004: return &thunk<&Veranke::add_vx_vy>;
+          case 0x0005: return &thunk<&Veranke::sub_vx_vy>;
+          case 0x0006: return &thunk<&Veranke::shr_vx<Q> >;
+          case 0x0007: return &thunk<&Veranke::subn_vx_vy>;
+          case 0x000E: return &thunk<&Veranke::shl_vx<Q> >;
+          default: return &invalid;
+        }
 
-              break;
+      case 0x9000: return (opcode & 0x000F) == 0 ? &thunk<&Veranke::sne_vx_vy> : &invalid;
+      case 0xA000: return &thunk<&Veranke::ld_i_addr>;
+      case 0xB000: return &thunk<&Veranke::jp_v0_addr<Q> >;
+      case 0xC000: return &thunk<&Veranke::rnd_vx_byte>;
+      case 0xD000: return &thunk<&Veranke::drw_vx_vy_nibble<Q> >;
+
+      case 0xE000:
+        switch (opcode & 0x00FF) {
+          case 0x009E: return &thunk<&Veranke::skp_vx>;
+          case 0x00A1: return &thunk<&Veranke::sknp_vx>;
+          default: return &invalid;
+        }
 
-            default:
-              break;
-          }
+      case 0xF000:
+        switch (opcode & 0x00FF) {
+          case 0x0000: return opcode == 0xF000 ? &thunk<&Veranke::ld_i_long> : &invalid;
+          case 0x0001: return &thunk<&Veranke::plane_n>;
+          case 0x0002: return opcode == 0xF002 ? &thunk<&Veranke::ld_audio_i> : &invalid;
+          case 0x0007: return &thunk<&Veranke::ld_vx_dt>;
+          case 0x000A: return &thunk<&Veranke::ld_vx_k>;
+          case 0x0015: return &thunk<&Veranke::ld_dt_vx>;
+          case 0x0018: return &thunk<&Veranke::ld_st_vx>;
+          case 0x001E: return &thunk<&Veranke::add_i_vx>;
+          case 0x0029: return &thunk<&Veranke::ld_f_vx>;
+          case 0x0030: return &thunk<&Veranke::ld_hf_vx>;
+          case 0x0033: return &thunk<&Veranke::ld_b_vx>;
+          case 0x003A: return &thunk<&Veranke::pitch_vx>;
+          case 0x0055: return &thunk<&Veranke::ld_i_vx<Q> >;
+          case 0x0065: return &thunk<&Veranke::ld_vx_i<Q> >;
+          case 0x0075: return &thunk<&Veranke::ld_r_vx>;
+          case 0x0085: return &thunk<&Veranke::ld_vx_r>;
+          default: return &invalid;
+        }
+    }
+
+    return &invalid;
+  }
+
+  static Handler decode(Profile profile, std::uint16_t opcode) {
+    switch (profile) {
+      case COSMAC: return decode<CosmacQuirks>(opcode);
+      case SCHIP: return decode<SchipQuirks>(opcode);
+      default: return decode<ModernQuirks>(opcode);
+    }
+  }
 
-          break;
+  static Quirks quirks(Profile profile) {
+    switch (profile) {
+      case COSMAC: return quirks_of<CosmacQuirks>();
+      case SCHIP: return quirks_of<SchipQuirks>();
+      default: return quirks_of<ModernQuirks>();
+    }
+  }
 
-        case 0xF000:
-          switch (opcode & 0x00FF) {
-            /*
-             * LD Vx, DT
-             *
-             * Set Vx = delay timer value.
-             *
-             * The value of DT is placed into Vx.
-             */
-            case 0x0007: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+  static const char * core_name(Core core) {
+    static const char * names[] = {"switch", "table", "predecoded", "jit", "fused"};
 
-              registers[x] = delay_timer;
+    return names[core];
+  }
 
-              program_counter += 2;
-            }
+  /*
+   * The core named name, as core_name spells it. Returns false if there is
+   * none.
+   */
+  static bool core_named(const char * name, Core &core) {
+    for (int i = SWITCH; i <= FUSED; ++i) {
+      if (std::strcmp(name, core_name((Core) i)) == 0) {
+        core = (Core) i;
 
-              break;
-
-            /*
-             * LD Vx, K
-             *
-             * Wait for a key press, store the value of the key in Vx.
-             *
-             * All execution stops until a key is pressed, then the
-             * value of that key is stored in Vx.
-             */
-            case 0x000A: {
-              x = (std::uint16_t) (opcode & 0x0F00) >> 0x0008;
-
-              for (std::uint16_t i = 0; i < 16; i++) {
-                if (keys[i] == 1) {
-                  registers[x] = (unsigned char) i;
-                }
-              }
-
-              program_counter += 2;
-            }
+        return true;
+      }
+    }
 
-              break;
+    return false;
+  }
 
-            /*
-             * LD DT, Vx
-             *
-             * Set delay timer = Vx.
-             *
-             * DT is set equal to the value of Vx.
-             */
-            case 0x0015: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+  static const char * profile_name(Profile profile) {
+    static const char * names[] = {"modern", "cosmac", "schip"};
 
-              delay_timer = registers[x];
+    return names[profile];
+  }
 
-              program_counter += 2;
-            }
+  /*
+   * The profile named name, as profile_name spells it. Returns false if
+   * there is none.
+   */
+  static bool profile_named(const char * name, Profile &profile) {
+    for (int i = MODERN; i <= SCHIP; ++i) {
+      if (std::strcmp(name, profile_name((Profile) i)) == 0) {
+        profile = (Profile) i;
 
-              break;
+        return true;
+      }
+    }
 
-            /*
-             * LD ST, Vx
-             *
-             * Set sound timer = Vx.
-             *
-             * ST is set equal to the value of Vx.
-             */
-            case 0x0018: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+    return false;
+  }
 
-              sound_timer = registers[x];
+  static const char * fusion_name(Fusion fusion) {
+    static const char * names[] = {"LD Vx, byte; ADD Vx, byte", "LD I, addr; DRW Vx, Vy, nibble", "LD Vx, DT; SE Vx, byte; JP addr", "LD Vx, [I]; ADD I, Vx", "ADD I, Vx; LD Vx, [I]"};
 
-              program_counter += 2;
-            }
+    return names[fusion];
+  }
 
-              break;
+  Core core;
+
+  Profile profile;
+
+  /*
+   * The PREDECODED core's cache, one entry per address of the first 4K of
+   * memory. Entries that have not been decoded since memory last changed
+   * hold predecode.
+   */
+  std::array<Operation, 4096> decoded;
+
+  /*
+   * How many times the FUSED core executed each superinstruction.
+   */
+  std::array<std::uint64_t, FUSIONS> fusions;
+
+  /*
+   * Instructions run accounted for by fast-forwarding idle loops instead of
+   * interpreting them.
+   */
+  std::uint64_t fast_forwarded;
+
+  /*
+   * The JIT core's translations, created on first use. Translated code is
+   * tied to the memory of the machine that produced it, so a copy of a
+   * machine starts with none.
+   */
+  class Translations {
+  public:
+    Translations(): jit(0) {
+    }
 
-            /*
-             * ADD I, Vx
-             *
-             * Set I = I + Vx.
-             *
-             * The values of I and Vx are added, and the results are
-             * stored in I.
-             */
-            case 0x001E: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+    Translations(const Translations &): jit(0) {
+    }
 
-              index += registers[x];
+    ~Translations();
+
+    Translations & operator=(const Translations &);
+
+    Jit * jit;
+  };
+
+  Translations translations;
+
+  /*
+   * What the machine has executed, in profiling builds (see
+   * veranke/profile.h). There the JIT core runs as PREDECODED, since
+   * translated blocks cannot be counted an instruction at a time.
+   */
+  Profiler profiler;
+
+private:
+  friend class Jit;
+
+  /*
+   * Set by a jump that may have entered an idle loop, so the run loop
+   * stops and lets run check it.
+   */
+  bool idling;
+
+  /*
+   * predecode, specialized on the machine's profile.
+   */
+  Handler undecoded;
+
+  /*
+   * Run up to n instructions with the chosen core, stopping early if the
+   * machine halts or enters an idle loop.
+   */
+  std::size_t execute(std::size_t n) {
+    switch (profile) {
+      case COSMAC: return execute<CosmacQuirks>(n);
+      case SCHIP: return execute<SchipQuirks>(n);
+      default: return execute<ModernQuirks>(n);
+    }
+  }
 
-              program_counter += 2;
-            }
+  template <class Q>
+  std::size_t execute(std::size_t n) {
+    switch (core) {
+      case TABLE: {
+        const Handler * handlers = table<Q>().handlers;
 
-              break;
+        std::size_t i = 0;
 
-            /*
-             * LD F, Vx
-             *
-             * Set I = location of sprite for digit Vx.
-             *
-             * The value of I is set to the location for the hexadecimal
-             * sprite corresponding to the value of Vx. See section 2.4,
-             * Display, for more information on the Chip-8 hexadecimal
-             * font.
-             */
-            case 0x0029: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+        for (; i < n && !waiting && !idling; ++i) {
+          std::uint16_t opcode = fetch();
 
-              index = (uint16_t) (registers[x] * 0x5);
+          tally();
 
-              program_counter += 2;
-            }
+          handlers[opcode](*this, Operands(opcode));
+        }
 
-              break;
+        return i;
+      }
+
+      case JIT:
+        if (!Profiler::ENABLED) {
+          return run_translations(n);
+        }
 
-            /*
-             * LD B, Vx
-             *
-             * Store BCD representation of Vx in memory locations I,
-             * I+1, and I+2.
-             *
-             * The interpreter takes the decimal value of Vx, and places
-             * the hundreds digit in memory at location in I, the tens
-             * digit at location I+1, and the ones digit at location I+2.
-             */
-            case 0x0033: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
+        /* fall through */
 
-              uint8_t tmp = (uint8_t) (registers[x] % 100);
+      case PREDECODED: {
+        std::size_t i = 0;
 
-              memory[index] = (uint8_t) (registers[x] / 100);
+        for (; i < n && !waiting && !idling; ++i) {
+          step();
+        }
 
-              memory[index + 1] = (uint8_t) ((registers[x] / 10) % 10);
+        return i;
+      }
 
-              memory[index + 2] = (uint8_t) (tmp % 10);
+      case FUSED: {
+        std::size_t executed = 0;
 
-              program_counter += 2;
-            }
+        while (executed < n && !waiting && !idling) {
+          if (program_counter >= decoded.size()) {
+            tally();
 
-              break;
-
-            /*
-             * LD [I], Vx
-             *
-             * Store registers V0 through Vx in memory starting at
-             * location I.
-             *
-             * The interpreter copies the values of registers V0 through
-             * Vx into memory, starting at the address in I.
-             */
-            case 0x0055: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-
-              for (size_t i = 0; i <= x; ++i) {
-                memory[index + i] = registers[i];
-              }
-
-              program_counter += 2;
-            }
+            step_unfused<Q>();
 
-              break;
-
-            /*
-             * LD Vx, [I]
-             *
-             * Read registers V0 through Vx from memory starting at
-             * location I.
-             *
-             * The interpreter reads values from memory starting at
-             * location I into registers V0 through Vx.
-             */
-            case 0x0065: {
-              x = (uint16_t) ((opcode & 0x0F00) >> 0x8);
-
-              for (size_t i = 0; i <= x; ++i) {
-                registers[i] = memory[index + i];
-              }
-
-              program_counter += 2;
-            }
+            ++executed;
 
-              break;
+            continue;
+          }
+
+          const Operation &operation = decoded[program_counter];
+
+          std::size_t length = operation.length;
+
+          if (length > n - executed) {
+            tally();
 
-            default:
-              break;
+            step_unfused<Q>();
+
+            ++executed;
+
+            continue;
           }
 
-          break;
+          /*
+           * The length is read first because predecode may fuse this
+           * entry while executing only its first instruction. A
+           * superinstruction tallies the rest of its instructions itself.
+           */
+          tally();
+
+          operation.handler(*this, operation.operands);
+
+          executed += length;
+        }
+
+        return executed;
+      }
+
+      default: {
+        std::size_t i = 0;
 
-        default:
-          break;
+        for (; i < n && !waiting && !idling; ++i) {
+          decode_and_execute<Q>();
+        }
+
+        return i;
       }
+    }
   }
 
-  std::array<std::uint8_t, 16> keypad;
 
-  std::array<std::uint8_t, 4096> memory;
+  /*
+   * If the program counter is at an idle loop, account for as many of the
+   * next n instructions as it would spend spinning and return how many
+   * that is. The loop is always re-checked against memory, since the jump
+   * that flagged it only guessed from its target.
+   */
+  std::size_t fast_forward(std::size_t n) {
+    idling = false;
 
-  std::array<std::uint8_t, 2048> video_memory;
+    std::uint16_t address = program_counter;
 
-  std::uint8_t delay_timer;
+    std::uint16_t opcode = fetch();
 
-  std::array<std::uint8_t, 16> registers;
+    std::size_t skipped = 0;
 
-  std::uint16_t index;
+    std::size_t length = 1;
 
-  std::uint16_t program_counter;
+    if ((address <= 0xFFF && opcode == (0x1000 | address)) || decode(profile, opcode) == &thunk<&Veranke::exit>) {
+      skipped = n;
+    } else if (address <= 0xFFA && (opcode & 0xF0FF) == 0xF007) {
+      std::uint16_t x = (opcode & 0x0F00) >> 8;
 
-  std::uint8_t sound_timer;
+      std::uint16_t test = (std::uint16_t) (memory[address + 2] << 8 | memory[address + 3]);
 
-  std::uint8_t stack_pointer;
+      std::uint16_t jump = (std::uint16_t) (memory[address + 4] << 8 | memory[address + 5]);
 
-  std::array<std::uint16_t, 16> stack;
+      if ((test & 0xFF00) == (0x3000 | x << 8) && jump == (0x1000 | address) && delay_timer != (test & 0x00FF)) {
+        skipped = n - n % 3;
 
-  std::array<std::uint8_t, 16> keys;
-};
+        length = 3;
+
+        if (skipped > 0) {
+          registers[x] = delay_timer;
+        }
+      }
+    }
+
+    fast_forwarded += skipped;
+
+    if (skipped > 0) {
+      tally(length, skipped / length);
+    }
+
+    return skipped;
+  }
+
+  /*
+   * Count the next length instructions, times times each, in the profiler.
+   * Compiles to nothing unless VERANKE_PROFILE is set.
+   */
+  void tally(std::size_t length = 1, std::uint64_t times = 1) {
+    profiler.count(memory.data(), program_counter, stack.data(), stack_pointer, length, times);
+  }
+
+  /*
+   * Execute the instruction at the program counter with the PREDECODED
+   * core. Past the cache, it is decoded afresh every time.
+   */
+  void step(void) {
+    tally();
+
+    if (program_counter >= decoded.size()) {
+      undecoded(*this, Operands());
+
+      return;
+    }
+
+    const Operation &operation = decoded[program_counter];
+
+    operation.handler(*this, operation.operands);
+  }
+
+  std::size_t run_translations(std::size_t n);
+
+  void invalidate_translations(std::size_t address);
+
+  void invalidate_translations(void);
+
+  /*
+   * The 64K-entry handler table used by the TABLE core. It is built once
+   * per process and profile, on first use, from decode.
+   */
+  template <class Q>
+  struct Table {
+    Table() {
+      for (std::size_t opcode = 0; opcode < 0x10000; ++opcode) {
+        handlers[opcode] = decode<Q>((std::uint16_t) opcode);
+      }
+    }
+
+    Handler handlers[0x10000];
+  };
+
+  template <class Q>
+  static const Table<Q> & table(void) {
+    static const Table<Q> instance;
+
+    return instance;
+  }
+
+  template <void (Veranke::*F)(const Operands &)>
+  static void thunk(Veranke &veranke, const Operands &operands) {
+    (veranke.*F)(operands);
+  }
+
+  /*
+   * Unknown opcodes leave the machine untouched, exactly as the switch
+   * core's default branches do.
+   */
+  static void invalid(Veranke &, const Operands &) {
+  }
+
+  /*
+   * Execute the instruction at the program counter without consulting the
+   * cache, as the FUSED core must when a superinstruction would overrun
+   * its budget.
+   */
+  template <class Q>
+  void step_unfused(void) {
+    std::uint16_t opcode = fetch();
+
+    decode<Q>(opcode)(*this, Operands(opcode));
+  }
+
+  /*
+   * Decode the instruction at the program counter into the cache, then
+   * execute it. With the FUSED core the entry may become a
+   * superinstruction, but only the first of its instructions runs now:
+   * the caller has accounted for one.
+   */
+  template <class Q>
+  static void predecode(Veranke &veranke, const Operands &) {
+    std::uint16_t address = veranke.program_counter;
+
+    std::uint16_t opcode = veranke.fetch();
+
+    Handler handler = decode<Q>(opcode);
+
+    if (address >= veranke.decoded.size()) {
+      handler(veranke, Operands(opcode));
+
+      return;
+    }
+
+    Operation &operation = veranke.decoded[address];
+
+    operation.handler = handler;
+
+    operation.operands = Operands(opcode);
+
+    operation.length = 1;
+
+    if (veranke.core == FUSED) {
+      veranke.fuse<Q>(address, opcode);
+    }
+
+    handler(veranke, operation.operands);
+  }
+
+  /*
+   * Turn the entry at address into a superinstruction if it starts one.
+   * The operands of the entries it spans are refreshed, since the fused
+   * handler reads them from there.
+   */
+  template <class Q>
+  void fuse(std::uint16_t address, std::uint16_t first) {
+    /*
+     * Every entry a superinstruction spans must lie in the cache.
+     */
+    if (address + 6u > decoded.size()) {
+      return;
+    }
+
+    std::uint16_t second = (std::uint16_t) (memory[address + 2] << 8 | memory[address + 3]);
+
+    std::uint16_t third = (std::uint16_t) (memory[address + 4] << 8 | memory[address + 5]);
+
+    Operation &operation = decoded[address];
+
+    if ((first & 0xF000) == 0x6000 && (second & 0xF000) == 0x7000) {
+      operation.handler = &fused<&Veranke::ld_vx_byte, &Veranke::add_vx_byte, LD_ADD>;
+    } else if ((first & 0xF000) == 0xA000 && (second & 0xF000) == 0xD000) {
+      operation.handler = &fused<&Veranke::ld_i_addr, &Veranke::drw_vx_vy_nibble<Q>, LD_I_DRW>;
+    } else if ((first & 0xF0FF) == 0xF065 && (second & 0xF0FF) == 0xF01E) {
+      operation.handler = &fused<&Veranke::ld_vx_i<Q>, &Veranke::add_i_vx, LD_VX_I_ADD_I>;
+    } else if ((first & 0xF0FF) == 0xF01E && (second & 0xF0FF) == 0xF065) {
+      operation.handler = &fused<&Veranke::add_i_vx, &Veranke::ld_vx_i<Q>, ADD_I_LD_VX_I>;
+    } else if ((first & 0xF0FF) == 0xF007 && (second & 0xF000) == 0x3000 && (third & 0xF000) == 0x1000) {
+      operation.handler = &timer_poll<Q>;
+
+      operation.length = 3;
+
+      decoded[address + 4].operands = Operands(third);
+    } else {
+      return;
+    }
+
+    if (operation.length == 1) {
+      operation.length = 2;
+    }
+
+    decoded[address + 2].operands = Operands(second);
+  }
+
+  /*
+   * Each handler advances the program counter, which then addresses the
+   * operands of the next instruction.
+   */
+  template <void (Veranke::*First)(const Operands &), void (Veranke::*Second)(const Operands &), Fusion F>
+  static void fused(Veranke &veranke, const Operands &operands) {
+    ++veranke.fusions[F];
+
+    (veranke.*First)(operands);
+
+    veranke.tally();
+
+    (veranke.*Second)(veranke.decoded[veranke.program_counter & 0xFFF].operands);
+  }
+
+  /*
+   * Fx07, 3xkk, 1nnn. When 3xkk skips the jump, the instruction after the
+   * jump runs in its place so that three instructions execute either way.
+   */
+  template <class Q>
+  static void timer_poll(Veranke &veranke, const Operands &operands) {
+    ++veranke.fusions[TIMER_POLL];
+
+    veranke.ld_vx_dt(operands);
+
+    std::uint16_t jump = (std::uint16_t) (veranke.program_counter + 2);
+
+    veranke.tally();
+
+    veranke.se_vx_byte(veranke.decoded[veranke.program_counter & 0xFFF].operands);
+
+    veranke.tally();
+
+    if (veranke.program_counter == jump) {
+      veranke.jp_addr(veranke.decoded[jump & 0xFFF].operands);
+    } else {
+      veranke.step_unfused<Q>();
+    }
+  }
+
+  /*
+   * The length of the instruction after this one: four bytes for
+   * XO-CHIP's F000 nnnn, two for any other. The skips step over it whole.
+   */
+  std::uint16_t next_length(void) const {
+    std::uint16_t next = (std::uint16_t) (program_counter + 2);
+
+    return memory[next] == 0xF0 && memory[(std::uint16_t) (next + 1)] == 0x00 ? 4 : 2;
+  }
+
+  /*
+   * Rows of the display at the current resolution, one bit per row.
+   */
+  std::uint64_t rows(void) const {
+    return hires ? ~0ull : 0xFFFFFFFFull;
+  }
+
+  /*
+   * Move the selected planes' rows down by distance, or up if it is
+   * negative, blanking the rows left behind.
+   */
+  void scroll_vertically(int distance) {
+    int count = (int) height();
+
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      if ((planes >> plane) & 1) {
+        Plane &bitplane = video_memory[plane];
+
+        if (distance > 0) {
+          std::copy_backward(bitplane.begin(), bitplane.begin() + std::max(count - distance, 0), bitplane.begin() + count);
+
+          std::fill(bitplane.begin(), bitplane.begin() + std::min(distance, count), Plane::value_type());
+        } else if (distance < 0) {
+          std::copy(bitplane.begin() - distance, bitplane.begin() + std::max(count, -distance), bitplane.begin());
+
+          std::fill(bitplane.begin() + std::max(count + distance, 0), bitplane.begin() + count, Plane::value_type());
+        }
+      }
+    }
+
+    damage |= rows();
+  }
+
+  /*
+   * Switch resolution. Every plane is cleared, as XO-CHIP requires, so no
+   * drawing straddles the two layouts.
+   */
+  void resize(bool high) {
+    damage |= rows();
+
+    hires = high;
+
+    damage |= rows();
+
+    video_memory.fill(Plane());
+  }
+
+  /*
+   * CLS
+   *
+   * Clear the display, or with XO-CHIP, the selected planes.
+   */
+  void cls(const Operands &) {
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      if ((planes >> plane) & 1) {
+        for (std::size_t row = 0; row < 64; ++row) {
+          damage |= (std::uint64_t) (video_memory[plane][row][0] != 0 || video_memory[plane][row][1] != 0) << row;
+        }
+
+        video_memory[plane].fill(Plane::value_type());
+      }
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * SCD nibble
+   *
+   * Scroll the display down n rows of the current resolution, and with
+   * XO-CHIP only the selected planes. Rows scrolled in are blank.
+   */
+  void scd_nibble(const Operands &operands) {
+    scroll_vertically((int) operands.n);
+
+    program_counter += 2;
+  }
+
+  /*
+   * SCU nibble
+   *
+   * XO-CHIP: scroll the selected planes up n rows.
+   */
+  void scu_nibble(const Operands &operands) {
+    scroll_vertically(-(int) operands.n);
+
+    program_counter += 2;
+  }
+
+  /*
+   * SCR
+   *
+   * Scroll the display right 4 columns.
+   */
+  void scr(const Operands &) {
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      if ((planes >> plane) & 1) {
+        for (std::size_t row = 0; row < height(); ++row) {
+          std::array<std::uint64_t, 2> &words = video_memory[plane][row];
+
+          if (hires) {
+            words[1] = words[1] >> 4 | words[0] << 60;
+          }
+
+          words[0] >>= 4;
+        }
+      }
+    }
+
+    damage |= rows();
+
+    program_counter += 2;
+  }
+
+  /*
+   * SCL
+   *
+   * Scroll the display left 4 columns.
+   */
+  void scl(const Operands &) {
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      if ((planes >> plane) & 1) {
+        for (std::size_t row = 0; row < height(); ++row) {
+          std::array<std::uint64_t, 2> &words = video_memory[plane][row];
+
+          words[0] <<= 4;
+
+          if (hires) {
+            words[0] |= words[1] >> 60;
+
+            words[1] <<= 4;
+          }
+        }
+      }
+    }
+
+    damage |= rows();
+
+    program_counter += 2;
+  }
+
+  /*
+   * EXIT
+   *
+   * Stop the interpreter. The program counter stays put, so the machine
+   * idles here from then on.
+   */
+  void exit(const Operands &) {
+    idling = true;
+  }
+
+  /*
+   * LOW
+   *
+   * Switch to the 64x32 display, clearing it.
+   */
+  void low(const Operands &) {
+    resize(false);
+
+    program_counter += 2;
+  }
+
+  /*
+   * HIGH
+   *
+   * Switch to the 128x64 display, clearing it.
+   */
+  void high(const Operands &) {
+    resize(true);
+
+    program_counter += 2;
+  }
+
+  /*
+   * RET
+   *
+   * Return from a subroutine.
+   *
+   * The interpreter sets the program counter to the address at the top of
+   * the stack, then subtracts 1 from the stack pointer.
+   *
+   * With the stack empty there is nothing to return to, so the machine
+   * halts here, as it does on an unknown opcode.
+   */
+  void ret(const Operands &) {
+    if (stack_pointer == 0) {
+      return;
+    }
+
+    program_counter = stack[--stack_pointer];
+
+    program_counter = (std::uint16_t) (program_counter + 2);
+  }
+
+  /*
+   * JP addr
+   *
+   * Jump to location nnn.
+   *
+   * The interpreter sets the program counter to nnn.
+   */
+  void jp_addr(const Operands &operands) {
+    /*
+     * A jump to itself, or back over two instructions, may be an idle
+     * loop; run checks before fast-forwarding it.
+     */
+    if (operands.nnn == program_counter || operands.nnn + 4 == program_counter) {
+      idling = true;
+    }
+
+    program_counter = operands.nnn;
+  }
+
+  /*
+   * CALL addr
+   *
+   * Call subroutine at nnn.
+   *
+   * The interpreter increments the stack pointer, then puts the current PC
+   * on the top of the stack. The PC is then set to nnn.
+   *
+   * With the stack full the machine halts here instead, as it does on an
+   * unknown opcode, rather than write past the stack.
+   */
+  void call_addr(const Operands &operands) {
+    if (stack_pointer >= stack.size()) {
+      return;
+    }
+
+    stack[stack_pointer++] = program_counter;
+
+    program_counter = operands.nnn;
+  }
+
+  /*
+   * SE Vx, byte
+   *
+   * Skip next instruction if Vx = kk.
+   *
+   * The interpreter compares register Vx to kk, and if they are equal,
+   * increments the program counter by 2.
+   */
+  void se_vx_byte(const Operands &operands) {
+    if (registers[operands.x] == operands.kk) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * SNE Vx, byte
+   *
+   * Skip next instruction if Vx != kk.
+   *
+   * The interpreter compares register Vx to kk, and if they are not equal,
+   * increments the program counter by 2.
+   */
+  void sne_vx_byte(const Operands &operands) {
+    if (registers[operands.x] != operands.kk) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * SE Vx, Vy
+   *
+   * Skip next instruction if Vx = Vy.
+   *
+   * The interpreter compares register Vx to register Vy, and if they are
+   * equal, increments the program counter by 2.
+   */
+  void se_vx_vy(const Operands &operands) {
+    if (registers[operands.x] == registers[operands.y]) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, byte
+   *
+   * Set Vx = kk.
+   *
+   * The interpreter puts the value kk into register Vx.
+   */
+  void ld_vx_byte(const Operands &operands) {
+    registers[operands.x] = operands.kk;
+
+    program_counter += 2;
+  }
+
+  /*
+   * ADD Vx, byte
+   *
+   * Set Vx = Vx + kk.
+   *
+   * Adds the value kk to the value of register Vx, then stores the result
+   * in Vx.
+   */
+  void add_vx_byte(const Operands &operands) {
+    registers[operands.x] += operands.kk;
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, Vy
+   *
+   * Set Vx = Vy.
+   *
+   * Stores the value of register Vy in register Vx.
+   */
+  void ld_vx_vy(const Operands &operands) {
+    registers[operands.x] = registers[operands.y];
+
+    program_counter += 2;
+  }
+
+  /*
+   * OR Vx, Vy
+   *
+   * Set Vx = Vx OR Vy.
+   *
+   * Performs a bitwise OR on the values of Vx and Vy, then stores the
+   * result in Vx. A bitwise OR compares the corrseponding bits from two
+   * values, and if either bit is 1, then the same bit in the result is also
+   * 1. Otherwise, it is 0. With the RESET_VF quirk, VF is then set to 0.
+   */
+  template <class Q>
+  void or_vx_vy(const Operands &operands) {
+    registers[operands.x] = registers[operands.x] | registers[operands.y];
+
+    if (Q::RESET_VF) {
+      registers[0xF] = 0;
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * AND Vx, Vy
+   *
+   * Set Vx = Vx AND Vy.
+   *
+   * Performs a bitwise AND on the values of Vx and Vy, then stores the
+   * result in Vx. A bitwise AND compares the corrseponding bits from two
+   * values, and if both bits are 1, then the same bit in the result is also
+   * 1. Otherwise, it is 0. With the RESET_VF quirk, VF is then set to 0.
+   */
+  template <class Q>
+  void and_vx_vy(const Operands &operands) {
+    registers[operands.x] = registers[operands.x] & registers[operands.y];
+
+    if (Q::RESET_VF) {
+      registers[0xF] = 0;
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * XOR Vx, Vy
+   *
+   * Set Vx = Vx XOR Vy.
+   *
+   * Performs a bitwise exclusive OR on the values of Vx and Vy, then stores
+   * the result in Vx. An exclusive OR compares the corrseponding bits from
+   * two values, and if the bits are not both the same, then the
+   * corresponding bit in the result is set to 1. Otherwise, it is 0. With
+   * the RESET_VF quirk, VF is then set to 0.
+   */
+  template <class Q>
+  void xor_vx_vy(const Operands &operands) {
+    registers[operands.x] = registers[operands.x] ^ registers[operands.y];
+
+    if (Q::RESET_VF) {
+      registers[0xF] = 0;
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * ADD Vx, Vy
+   *
+   * Set Vx = Vx + Vy, set VF = carry.
+   *
+   * The values of Vx and Vy are added together. If the result is greater
+   * than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest
+   * 8 bits of the result are kept, and stored in Vx.
+   */
+  void add_vx_vy(const Operands &operands) {
+    if (registers[operands.y] > (0xFF - registers[operands.x])) {
+      registers[0xF] = 1;
+    } else {
+      registers[0xF] = 0;
+    }
+
+    registers[operands.x] += registers[operands.y];
+
+    program_counter += 2;
+  }
+
+  /*
+   * SUB Vx, Vy
+   *
+   * Set Vx = Vx - Vy, set VF = NOT borrow.
+   *
+   * If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted
+   * from Vx, and the results stored in Vx.
+   */
+  void sub_vx_vy(const Operands &operands) {
+    if (registers[operands.x] > registers[operands.y]) {
+      registers[0xF] = 0x1;
+    } else {
+      registers[0xF] = 0x0;
+    }
+
+    registers[operands.x] = registers[operands.x] - registers[operands.y];
+
+    program_counter += 2;
+  }
+
+  /*
+   * SHR Vx {, Vy}
+   *
+   * Set Vx = Vx SHR 1.
+   *
+   * If the least-significant bit of Vx is 1, then VF is set to 1, otherwise
+   * 0. Then Vx is divided by 2. With the SHIFT_VY quirk, Vy is shifted
+   * instead and the result stored in Vx.
+   */
+  template <class Q>
+  void shr_vx(const Operands &operands) {
+    std::uint8_t source = Q::SHIFT_VY ? operands.y : operands.x;
+
+    if (registers[source] & 0x1) {
+      registers[0xF] = 1;
+    } else {
+      registers[0xF] = 0;
+    }
+
+    registers[operands.x] = (std::uint8_t) (registers[source] / 2);
+
+    program_counter += 2;
+  }
+
+  /*
+   * SUBN Vx, Vy
+   *
+   * Set Vx = Vy - Vx, set VF = NOT borrow.
+   *
+   * If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted
+   * from Vy, and the results stored in Vx.
+   */
+  void subn_vx_vy(const Operands &operands) {
+    if (registers[operands.y] > registers[operands.x]) {
+      registers[0xF] = 0x1;
+    } else {
+      registers[0xF] = 0x0;
+    }
+
+    registers[operands.x] = registers[operands.y] - registers[operands.x];
+
+    program_counter += 2;
+  }
+
+  /*
+   * SHL Vx {, Vy}
+   *
+   * Set Vx = Vx SHL 1.
+   *
+   * If the most-significant bit of Vx is 1, then VF is set to 1, otherwise
+   * to 0. Then Vx is multiplied by 2. With the SHIFT_VY quirk, Vy is
+   * shifted instead and the result stored in Vx.
+   */
+  template <class Q>
+  void shl_vx(const Operands &operands) {
+    std::uint8_t source = Q::SHIFT_VY ? operands.y : operands.x;
+
+    if (registers[source] & 0x80) {
+      registers[0xF] = 1;
+    } else {
+      registers[0xF] = 0;
+    }
+
+    registers[operands.x] = (std::uint8_t) (registers[source] * 2);
+
+    program_counter += 2;
+  }
+
+  /*
+   * SNE Vx, Vy
+   *
+   * Skip next instruction if Vx != Vy.
+   *
+   * The values of Vx and Vy are compared, and if they are not equal, the
+   * program counter is increased by 2.
+   */
+  void sne_vx_vy(const Operands &operands) {
+    if (registers[operands.x] != registers[operands.y]) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD I, addr
+   *
+   * Set I = nnn.
+   *
+   * The value of register I is set to nnn.
+   */
+  void ld_i_addr(const Operands &operands) {
+    index = operands.nnn;
+
+    program_counter += 2;
+  }
+
+  /*
+   * JP V0, addr
+   *
+   * Jump to location nnn + V0.
+   *
+   * The program counter is set to nnn plus the value of V0. With the
+   * JUMP_VX quirk it is set to nnn plus the value of Vx instead.
+   */
+  template <class Q>
+  void jp_v0_addr(const Operands &operands) {
+    program_counter = (uint16_t) (operands.nnn + registers[Q::JUMP_VX ? operands.x : 0]);
+  }
+
+  /*
+   * RND Vx, byte
+   *
+   * Set Vx = random byte AND kk.
+   *
+   * The interpreter generates a random number from 0 to 255, which is then
+   * ANDed with the value kk. The results are stored in Vx. See instruction
+   * 8xy2 for more information on AND.
+   */
+  void rnd_vx_byte(const Operands &operands) {
+    random_state ^= random_state >> 12;
+
+    random_state ^= random_state << 25;
+
+    random_state ^= random_state >> 27;
+
+    std::uint8_t random = (std::uint8_t) ((random_state * 0x2545F4914F6CDD1Dull) >> 56);
+
+    registers[operands.x] = (uint8_t) (random & operands.kk);
+
+    program_counter += 2;
+  }
+
+  /*
+   * DRW Vx, Vy, nibble
+   *
+   * Display n-byte sprite starting at memory location I at (Vx, Vy), set
+   * VF = collision.
+   *
+   * The interpreter reads n bytes from memory, starting at the address
+   * stored in I. These bytes are then displayed as sprites on screen at
+   * coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If
+   * this causes any pixels to be erased, VF is set to 1, otherwise it is
+   * set to 0. If the sprite is positioned so part of it is outside the
+   * coordinates of the display, it wraps around to the opposite side of the
+   * screen. See instruction 8xy3 for more information on XOR, and section
+   * 2.4, Display, for more information on the Chip-8 screen and sprites.
+   *
+   * With the CLIP quirk, the parts of the sprite outside the display are
+   * not drawn instead.
+   *
+   * SUPER-CHIP: DRW Vx, Vy, 0 draws a 16x16 sprite, two bytes per row.
+   * XO-CHIP: the sprite is drawn into each selected plane in turn, each
+   * plane's rows following the last's in memory.
+   */
+  template <class Q>
+  void drw_vx_vy_nibble(const Operands &operands) {
+    unsigned columns = (unsigned) width();
+
+    unsigned lines = (unsigned) height();
+
+    unsigned x = registers[operands.x] & (columns - 1);
+
+    unsigned y = registers[operands.y] & (lines - 1);
+
+    std::size_t size = operands.n != 0 ? operands.n : 16;
+
+    std::size_t stride = operands.n != 0 ? 1 : 2;
+
+    std::size_t drawn = size;
+
+    if (Q::CLIP && y + drawn > lines) {
+      drawn = lines - y;
+    }
+
+    std::uint64_t collision = 0;
+
+    std::uint16_t address = index;
+
+    for (std::size_t plane = 0; plane < PLANES; ++plane) {
+      if (((planes >> plane) & 1) == 0) {
+        continue;
+      }
+
+      for (std::size_t i = 0; i < drawn; ++i) {
+        /*
+         * The sprite row, in the leftmost columns of a word.
+         */
+        std::uint64_t sprite = (std::uint64_t) memory[(std::uint16_t) (address + i * stride)] << 56;
+
+        if (stride == 2) {
+          sprite |= (std::uint64_t) memory[(std::uint16_t) (address + i * stride + 1)] << 48;
+        }
+
+        std::size_t row = (y + i) & (lines - 1);
+
+        collision |= blit<Q>(video_memory[plane][row], sprite, x);
+
+        profiler.sprite(sprite);
+
+        damage |= (std::uint64_t) (sprite != 0) << row;
+      }
+
+      address = (std::uint16_t) (address + size * stride);
+    }
+
+    registers[0xF] = collision != 0;
+
+    program_counter += 2;
+  }
+
+  /*
+   * XOR a sprite row, held in the leftmost columns of sprite, into words
+   * at column x, and return the pixels it erased. Shifted right by x, it
+   * lands in x's word; what falls off that word's end goes into the next
+   * word, or with no next word, wraps around to the first unless the CLIP
+   * quirk drops it.
+   */
+  template <class Q>
+  std::uint64_t blit(std::array<std::uint64_t, 2> &words, std::uint64_t sprite, unsigned x) {
+    unsigned shift = x & 63;
+
+    std::uint64_t head = sprite >> shift;
+
+    std::uint64_t tail = shift != 0 ? sprite << (64 - shift) : 0;
+
+    std::size_t first = hires ? x >> 6 : 0;
+
+    std::size_t last = hires ? 1 : 0;
+
+    std::uint64_t collision = words[first] & head;
+
+    words[first] ^= head;
+
+    if (first < last || !Q::CLIP) {
+      std::size_t next = first < last ? first + 1 : 0;
+
+      collision |= words[next] & tail;
+
+      words[next] ^= tail;
+    }
+
+    return collision;
+  }
+
+  /*
+   * SKP Vx
+   *
+   * Skip next instruction if key with the value of Vx is pressed.
+   *
+   * Checks the keyboard, and if the key corresponding to the value of Vx is
+   * currently in the down position, PC is increased by 2.
+   */
+  void skp_vx(const Operands &operands) {
+    if ((keypad >> (registers[operands.x] & 0xF)) & 1) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * SKNP Vx
+   *
+   * Skip next instruction if key with the value of Vx is not pressed.
+   *
+   * Checks the keyboard, and if the key corresponding to the value of Vx is
+   * currently in the up position, PC is increased by 2.
+   */
+  void sknp_vx(const Operands &operands) {
+    if (((keypad >> (registers[operands.x] & 0xF)) & 1) == 0) {
+      program_counter += next_length();
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, DT
+   *
+   * Set Vx = delay timer value.
+   *
+   * The value of DT is placed into Vx.
+   */
+  void ld_vx_dt(const Operands &operands) {
+    registers[operands.x] = delay_timer;
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, K
+   *
+   * Wait for a key press, store the value of the key in Vx.
+   *
+   * All execution stops until a key is pressed, then the value of that key
+   * is stored in Vx. With no key down, PC stays on this instruction and the
+   * machine halts until run is next called with a key down.
+   */
+  void ld_vx_k(const Operands &operands) {
+    if (keypad == 0) {
+      waiting = true;
+
+      return;
+    }
+
+    for (std::uint16_t i = 0; i < 16; i++) {
+      if ((keypad >> i) & 1) {
+        registers[operands.x] = (unsigned char) i;
+      }
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD DT, Vx
+   *
+   * Set delay timer = Vx.
+   *
+   * DT is set equal to the value of Vx.
+   */
+  void ld_dt_vx(const Operands &operands) {
+    delay_timer = registers[operands.x];
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD ST, Vx
+   *
+   * Set sound timer = Vx.
+   *
+   * ST is set equal to the value of Vx.
+   */
+  void ld_st_vx(const Operands &operands) {
+    sound_timer = registers[operands.x];
+
+    program_counter += 2;
+  }
+
+  /*
+   * ADD I, Vx
+   *
+   * Set I = I + Vx.
+   *
+   * The values of I and Vx are added, and the results are stored in I.
+   */
+  void add_i_vx(const Operands &operands) {
+    index += registers[operands.x];
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD F, Vx
+   *
+   * Set I = location of sprite for digit Vx.
+   *
+   * The value of I is set to the location for the hexadecimal sprite
+   * corresponding to the value of Vx. See section 2.4, Display, for more
+   * information on the Chip-8 hexadecimal font.
+   */
+  void ld_f_vx(const Operands &operands) {
+    index = (uint16_t) (registers[operands.x] * 0x5);
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD B, Vx
+   *
+   * Store BCD representation of Vx in memory locations I, I+1, and I+2.
+   *
+   * The interpreter takes the decimal value of Vx, and places the hundreds
+   * digit in memory at location in I, the tens digit at location I+1, and
+   * the ones digit at location I+2.
+   */
+  void ld_b_vx(const Operands &operands) {
+    uint8_t tmp = (uint8_t) (registers[operands.x] % 100);
+
+    write(index, (uint8_t) (registers[operands.x] / 100));
+
+    write(index + 1, (uint8_t) ((registers[operands.x] / 10) % 10));
+
+    write(index + 2, (uint8_t) (tmp % 10));
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD [I], Vx
+   *
+   * Store registers V0 through Vx in memory starting at location I.
+   *
+   * The interpreter copies the values of registers V0 through Vx into
+   * memory, starting at the address in I. With the INCREMENT_I quirk, I is
+   * then advanced past the last byte written.
+   */
+  template <class Q>
+  void ld_i_vx(const Operands &operands) {
+    for (size_t i = 0; i <= operands.x; ++i) {
+      write(index + i, registers[i]);
+    }
+
+    if (Q::INCREMENT_I) {
+      index = (std::uint16_t) (index + operands.x + 1);
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, [I]
+   *
+   * Read registers V0 through Vx from memory starting at location I.
+   *
+   * The interpreter reads values from memory starting at location I into
+   * registers V0 through Vx. With the INCREMENT_I quirk, I is then advanced
+   * past the last byte read.
+   */
+  template <class Q>
+  void ld_vx_i(const Operands &operands) {
+    for (size_t i = 0; i <= operands.x; ++i) {
+      registers[i] = memory[(std::uint16_t) (index + i)];
+    }
+
+    if (Q::INCREMENT_I) {
+      index = (std::uint16_t) (index + operands.x + 1);
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD HF, Vx
+   *
+   * SUPER-CHIP: set I = location of the 8x10 sprite for digit Vx.
+   */
+  void ld_hf_vx(const Operands &operands) {
+    index = (std::uint16_t) (LARGE_FONT + (registers[operands.x] & 0xF) * 10);
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD R, Vx
+   *
+   * SUPER-CHIP: store registers V0 through Vx in the user flags.
+   */
+  void ld_r_vx(const Operands &operands) {
+    for (size_t i = 0; i <= operands.x; ++i) {
+      flags[i] = registers[i];
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx, R
+   *
+   * SUPER-CHIP: read registers V0 through Vx from the user flags.
+   */
+  void ld_vx_r(const Operands &operands) {
+    for (size_t i = 0; i <= operands.x; ++i) {
+      registers[i] = flags[i];
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD [I], Vx - Vy
+   *
+   * XO-CHIP: store registers Vx through Vy, in that order (descending if
+   * x > y), in memory starting at location I. I is not changed.
+   */
+  void ld_i_vx_vy(const Operands &operands) {
+    int step = operands.x <= operands.y ? 1 : -1;
+
+    std::size_t count = (std::size_t) std::abs(operands.y - operands.x) + 1;
+
+    for (size_t i = 0; i < count; ++i) {
+      write(index + i, registers[operands.x + step * (int) i]);
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD Vx - Vy, [I]
+   *
+   * XO-CHIP: read registers Vx through Vy, in that order (descending if
+   * x > y), from memory starting at location I. I is not changed.
+   */
+  void ld_vx_vy_i(const Operands &operands) {
+    int step = operands.x <= operands.y ? 1 : -1;
+
+    std::size_t count = (std::size_t) std::abs(operands.y - operands.x) + 1;
+
+    for (size_t i = 0; i < count; ++i) {
+      registers[operands.x + step * (int) i] = memory[(std::uint16_t) (index + i)];
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * PLANE n
+   *
+   * XO-CHIP: select the bitplanes (one bit per plane) that DRW, CLS, and
+   * the scrolls act on.
+   */
+  void plane_n(const Operands &operands) {
+    planes = operands.x;
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD AUDIO, [I]
+   *
+   * XO-CHIP: load the 16-byte audio pattern from memory starting at
+   * location I.
+   */
+  void ld_audio_i(const Operands &) {
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      pattern[i] = memory[(std::uint16_t) (index + i)];
+    }
+
+    program_counter += 2;
+  }
+
+  /*
+   * PITCH Vx
+   *
+   * XO-CHIP: set the audio pattern's playback rate from Vx.
+   */
+  void pitch_vx(const Operands &operands) {
+    pitch = registers[operands.x];
+
+    program_counter += 2;
+  }
+
+  /*
+   * LD I, long addr
+   *
+   * XO-CHIP: set I = the 16-bit address in the two bytes after the
+   * opcode, and skip over them.
+   */
+  void ld_i_long(const Operands &) {
+    index = (std::uint16_t) (memory[(std::uint16_t) (program_counter + 2)] << 8 | memory[(std::uint16_t) (program_counter + 3)]);
+
+    program_counter += 4;
+  }
+};
+
+#include "veranke/jit.h"
 
 #endif
@@ -0,0 +1,317 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_AUDIO_H
+
+#define VERANKE_AUDIO_H
+
+#include "veranke.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+/*
+ * Turns a machine's sound state into 16-bit mono samples, one 60 Hz frame
+ * at a time. While the sound timer runs it plays the XO-CHIP audio
+ * pattern at the rate the pitch register sets; a program that never
+ * touches either gets the defaults' 500 Hz square wave. The phase carries
+ * over from frame to frame, so consecutive frames join without a click.
+ */
+class Synthesizer {
+public:
+  static const unsigned DEFAULT_RATE = 48000;
+
+  static const std::int16_t AMPLITUDE = 8192;
+
+  explicit Synthesizer(unsigned rate = DEFAULT_RATE): rate(rate), phase(0), remainder(0) {
+  }
+
+  /*
+   * The most samples render writes for one frame.
+   */
+  std::size_t maximum(void) const {
+    return rate / 60 + 1;
+  }
+
+  /*
+   * Write the samples for one frame of machine, as it stands before its
+   * timers tick, to samples. Returns how many: rate / 60, give or take
+   * one, so that every 60 frames are exactly one second.
+   */
+  std::size_t render(const MachineState &machine, std::int16_t * samples) {
+    remainder += rate;
+
+    std::size_t n = remainder / 60;
+
+    remainder %= 60;
+
+    if (machine.sound_timer == 0) {
+      for (std::size_t i = 0; i < n; ++i) {
+        samples[i] = 0;
+      }
+
+      return n;
+    }
+
+    double step = 4000.0 * std::pow(2.0, (machine.pitch - 64) / 48.0) / rate;
+
+    for (std::size_t i = 0; i < n; ++i) {
+      std::size_t bit = (std::size_t) phase;
+
+      bool high = (machine.pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+
+      samples[i] = (std::int16_t) (high ? AMPLITUDE : -AMPLITUDE);
+
+      phase += step;
+
+      if (phase >= 128) {
+        phase -= 128;
+      }
+    }
+
+    return n;
+  }
+
+  unsigned rate;
+
+private:
+  /*
+   * The position in the 128-bit pattern, in bits.
+   */
+  double phase;
+
+  unsigned remainder;
+};
+
+/*
+ * A single-producer, single-consumer ring of samples between the
+ * emulator thread and an audio device's callback. Neither side ever
+ * locks or waits on the other.
+ *
+ * The producer pushes whole frames and drops a frame that does not fit,
+ * e.g., in TURBO mode, which makes frames faster than the device plays
+ * them; the ring stays full and latency stays bounded by its capacity.
+ * The consumer pulls whatever the device asks for; if the producer has
+ * fallen behind, e.g., under host load, it fades the last sample out
+ * rather than dropping to silence at once, and picks up again where the
+ * producer resumes.
+ */
+class AudioRing {
+public:
+  /*
+   * About 85 ms at 48 kHz: five frames, enough to ride out FIXED mode
+   * catching up on overdue frames.
+   */
+  static const std::size_t DEFAULT_CAPACITY = 4096;
+
+  /*
+   * capacity is rounded up to a power of two.
+   */
+  explicit AudioRing(std::size_t capacity = DEFAULT_CAPACITY): head(0), tail(0), last(0) {
+    std::size_t size = 1;
+
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    samples.resize(size);
+
+    mask = size - 1;
+  }
+
+  /*
+   * Producer side: append n samples, all or none. Returns false, dropping
+   * them, if they do not fit.
+   */
+  bool push(const std::int16_t * source, std::size_t n) {
+    std::size_t position = head.load(std::memory_order_relaxed);
+
+    if (n > samples.size() - (position - tail.load(std::memory_order_acquire))) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i < n; ++i) {
+      samples[(position + i) & mask] = source[i];
+    }
+
+    head.store(position + n, std::memory_order_release);
+
+    return true;
+  }
+
+  /*
+   * Consumer side: fill destination with n samples. Returns how many came
+   * from the producer; the rest fade out the last sample played.
+   */
+  std::size_t pull(std::int16_t * destination, std::size_t n) {
+    std::size_t position = tail.load(std::memory_order_relaxed);
+
+    std::size_t available = head.load(std::memory_order_acquire) - position;
+
+    std::size_t count = available < n ? available : n;
+
+    for (std::size_t i = 0; i < count; ++i) {
+      destination[i] = samples[(position + i) & mask];
+    }
+
+    tail.store(position + count, std::memory_order_release);
+
+    if (count > 0) {
+      last = destination[count - 1];
+    }
+
+    for (std::size_t i = count; i < n; ++i) {
+      last = (std::int16_t) (last * 63 / 64);
+
+      destination[i] = last;
+    }
+
+    return count;
+  }
+
+  /*
+   * Samples waiting to be pulled.
+   */
+  std::size_t size(void) const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<std::int16_t> samples;
+
+  std::size_t mask;
+
+  alignas(64) std::atomic<std::size_t> head;
+
+  alignas(64) std::atomic<std::size_t> tail;
+
+  /*
+   * The consumer's last sample, which an underrun fades out from.
+   */
+  std::int16_t last;
+};
+
+/*
+ * Writes samples to a 16-bit mono PCM WAV file, e.g., to check a headless
+ * run's audio. The header's sizes are filled in when the file is closed.
+ */
+class WavWriter {
+public:
+  WavWriter(): written(0) {
+  }
+
+  ~WavWriter() {
+    close();
+  }
+
+  bool open(const char * path, unsigned rate = Synthesizer::DEFAULT_RATE) {
+    close();
+
+    file.open(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+
+    if (!file.is_open()) {
+      return false;
+    }
+
+    written = 0;
+
+    file.write("RIFF", 4);
+
+    put(36, 4);
+
+    file.write("WAVEfmt ", 8);
+
+    put(16, 4);
+
+    put(1, 2);
+
+    put(1, 2);
+
+    put(rate, 4);
+
+    put(rate * 2, 4);
+
+    put(2, 2);
+
+    put(16, 2);
+
+    file.write("data", 4);
+
+    put(0, 4);
+
+    return file.good();
+  }
+
+  void write(const std::int16_t * samples, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      put((std::uint16_t) samples[i], 2);
+    }
+
+    written += n;
+  }
+
+  /*
+   * Fill in the header and close the file. Returns false if any write
+   * failed.
+   */
+  bool close(void) {
+    if (!file.is_open()) {
+      return true;
+    }
+
+    file.seekp(4);
+
+    put(36 + written * 2, 4);
+
+    file.seekp(40);
+
+    put(written * 2, 4);
+
+    bool ok = file.good();
+
+    file.close();
+
+    return ok;
+  }
+
+  bool is_open(void) const {
+    return file.is_open();
+  }
+
+private:
+  void put(std::uint64_t value, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      file.put((char) (value >> (8 * i)));
+    }
+  }
+
+  std::ofstream file;
+
+  std::uint64_t written;
+};
+
+#endif
@@ -0,0 +1,553 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_BATCH_H
+
+#define VERANKE_BATCH_H
+
+#include "veranke.h"
+
+#include <cstring>
+#include <vector>
+
+/*
+ * A vector of W bytes. GCC only applies a dependent vector_size when the
+ * size is itself a template parameter, hence this indirection.
+ */
+template <std::size_t W>
+struct VerankeVector {
+  typedef std::uint8_t Bytes __attribute__((vector_size(W)));
+};
+
+/*
+ * N copies of the same ROM run in lockstep.
+ *
+ * The CPU state that nearly every instruction touches (V0-VF, I, PC, SP,
+ * and the timers) is kept structure-of-arrays, one array of N lanes per
+ * register. Memory, the display, the stack, and the keypad stay with a
+ * per-lane Veranke.
+ *
+ * While every lane is at the same PC, and so (unless the ROM has rewritten
+ * its code differently in different lanes) at the same opcode, register
+ * instructions run across all lanes at once on the widest vectors the
+ * target enables: 32 lanes per operation with AVX2, 16 with SSE2. Control
+ * flow that splits the lanes is evaluated per lane. Every other
+ * instruction, and every instruction once the lanes have diverged, runs
+ * per lane on that lane's Veranke, so the semantics are the scalar core's
+ * by construction. Lanes that reach the same PC again run in lockstep
+ * again.
+ */
+template <std::size_t N>
+class VerankeBatch {
+public:
+#if defined(__AVX2__)
+  static const std::size_t VECTOR = 32;
+#else
+  static const std::size_t VECTOR = 16;
+#endif
+
+  static const std::size_t WIDTH = N < VECTOR ? N : VECTOR;
+
+  typedef typename VerankeVector<WIDTH>::Bytes Bytes;
+
+  static_assert(N > 0 && (N & (N - 1)) == 0, "the number of lanes must be a power of two");
+
+  explicit VerankeBatch(Veranke::Profile profile = Veranke::MODERN): vector_steps(0), scalar_steps(0), quirks(Veranke::quirks(profile)), machines(N, Veranke(Veranke::PREDECODED, 0, profile)) {
+    written.fill(0);
+
+    for (std::size_t lane = 0; lane < N; ++lane) {
+      pull(lane);
+    }
+  }
+
+  /*
+   * Load the same ROM into every lane.
+   */
+  bool load(const std::uint8_t * rom, std::size_t size) {
+    for (std::size_t lane = 0; lane < N; ++lane) {
+      if (!machines[lane].load(rom, size)) {
+        return false;
+      }
+    }
+
+    written.fill(0);
+
+    return true;
+  }
+
+  /*
+   * Execute n instructions in every lane.
+   */
+  void run(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      step();
+    }
+  }
+
+  /*
+   * Count every lane's timers down by one.
+   */
+  void tick(void) {
+    for (std::size_t c = 0; c < N; c += WIDTH) {
+      Bytes delay = get(delay_timer + c);
+
+      Bytes sound = get(sound_timer + c);
+
+      put(delay_timer + c, delay - ((Bytes) (delay != 0) & 1));
+
+      put(sound_timer + c, sound - ((Bytes) (sound != 0) & 1));
+    }
+  }
+
+  /*
+   * A copy of lane's complete state, e.g., to compare against a scalar
+   * Veranke running the same input.
+   */
+  Veranke lane(std::size_t lane) const {
+    Veranke veranke = machines[lane];
+
+    push(lane, veranke);
+
+    return veranke;
+  }
+
+  /*
+   * The lane's keypad, for feeding it input.
+   */
+  std::uint16_t & keypad(std::size_t lane) {
+    return machines[lane].keypad;
+  }
+
+  /*
+   * Give the lane its own RND Vx, byte sequence. Lanes start seeded alike.
+   */
+  void reseed(std::size_t lane, std::uint64_t seed) {
+    machines[lane].reseed(seed);
+  }
+
+  /*
+   * Steps that ran one instruction across all lanes, and steps that fell
+   * back to running each lane on its own.
+   */
+  std::uint64_t vector_steps;
+
+  std::uint64_t scalar_steps;
+
+private:
+  void step(void) {
+    std::uint16_t address = program_counter[0];
+
+    bool converged = true;
+
+    for (std::size_t lane = 1; lane < N; ++lane) {
+      converged &= program_counter[lane] == address;
+    }
+
+    if (converged) {
+      const Veranke &first = machines[0];
+
+      std::uint16_t opcode = opcode_at(first, address);
+
+      if (same_code(address, opcode) && vector(opcode)) {
+        ++vector_steps;
+
+        return;
+      }
+    }
+
+    for (std::size_t lane = 0; lane < N; ++lane) {
+      scalar(lane);
+    }
+
+    ++scalar_steps;
+  }
+
+  /*
+   * Whether every lane holds opcode at address. Lanes start with the same
+   * ROM, so this only needs checking where some lane has written memory.
+   */
+  bool same_code(std::uint16_t address, std::uint16_t opcode) const {
+    if (!written[address] && !written[(std::uint16_t) (address + 1)]) {
+      return true;
+    }
+
+    for (std::size_t lane = 1; lane < N; ++lane) {
+      if (opcode_at(machines[lane], address) != opcode) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static std::uint16_t opcode_at(const Veranke &machine, std::uint16_t address) {
+    return (std::uint16_t) (machine.memory[address] << 8 | machine.memory[(std::uint16_t) (address + 1)]);
+  }
+
+  /*
+   * How far a skip at address steps when it skips, the same in every
+   * lane: past a two-byte instruction, or past XO-CHIP's four-byte
+   * F000 nnnn. Returns 0 if the lanes disagree.
+   */
+  std::uint16_t skip_length(std::uint16_t address) const {
+    std::uint16_t next = (std::uint16_t) (address + 2);
+
+    std::uint16_t opcode = opcode_at(machines[0], next);
+
+    if (!same_code(next, opcode)) {
+      return 0;
+    }
+
+    return opcode == 0xF000 ? 6 : 4;
+  }
+
+  /*
+   * Run opcode across every lane. Returns false, leaving the lanes
+   * untouched, for opcodes that only run per lane.
+   */
+  bool vector(std::uint16_t opcode) {
+    Veranke::Operands operands(opcode);
+
+    std::uint8_t * vx = registers[operands.x];
+
+    std::uint8_t * vy = registers[operands.y];
+
+    std::uint8_t * vf = registers[0xF];
+
+    switch (opcode & 0xF000) {
+      case 0x1000:
+        for (std::size_t lane = 0; lane < N; ++lane) {
+          program_counter[lane] = operands.nnn;
+        }
+
+        return true;
+
+      case 0x3000:
+      case 0x4000: {
+        std::uint16_t length = skip_length(program_counter[0]);
+
+        if (length == 0) {
+          return false;
+        }
+
+        bool equal = (opcode & 0xF000) == 0x3000;
+
+        for (std::size_t lane = 0; lane < N; ++lane) {
+          program_counter[lane] += (vx[lane] == operands.kk) == equal ? length : 2;
+        }
+      }
+
+        return true;
+
+      case 0x5000:
+      case 0x9000: {
+        std::uint16_t length = skip_length(program_counter[0]);
+
+        if (operands.n != 0 || length == 0) {
+          return false;
+        }
+
+        bool equal = (opcode & 0xF000) == 0x5000;
+
+        for (std::size_t lane = 0; lane < N; ++lane) {
+          program_counter[lane] += (vx[lane] == vy[lane]) == equal ? length : 2;
+        }
+      }
+
+        return true;
+
+      case 0x6000:
+        for (std::size_t c = 0; c < N; c += WIDTH) {
+          put(vx + c, splat(operands.kk));
+        }
+
+        break;
+
+      case 0x7000:
+        for (std::size_t c = 0; c < N; c += WIDTH) {
+          put(vx + c, get(vx + c) + splat(operands.kk));
+        }
+
+        break;
+
+      case 0x8000:
+        if (!arithmetic(operands.n, vx, vy, vf)) {
+          return false;
+        }
+
+        break;
+
+      case 0xA000:
+        for (std::size_t lane = 0; lane < N; ++lane) {
+          index[lane] = operands.nnn;
+        }
+
+        break;
+
+      case 0xF000:
+        switch (operands.kk) {
+          case 0x07:
+            std::memcpy(vx, delay_timer, N);
+
+            break;
+
+          case 0x15:
+            std::memcpy(delay_timer, vx, N);
+
+            break;
+
+          case 0x18:
+            std::memcpy(sound_timer, vx, N);
+
+            break;
+
+          case 0x1E:
+            for (std::size_t lane = 0; lane < N; ++lane) {
+              index[lane] = (std::uint16_t) (index[lane] + vx[lane]);
+            }
+
+            break;
+
+          case 0x29:
+            for (std::size_t lane = 0; lane < N; ++lane) {
+              index[lane] = (std::uint16_t) (vx[lane] * 5);
+            }
+
+            break;
+
+          default:
+            return false;
+        }
+
+        break;
+
+      default:
+        return false;
+    }
+
+    for (std::size_t lane = 0; lane < N; ++lane) {
+      program_counter[lane] += 2;
+    }
+
+    return true;
+  }
+
+  /*
+   * 8xy*. As in the scalar handlers, VF is written before Vx is
+   * recomputed from fresh reads, which matters when x or y is F, and
+   * then reset if the profile resets it.
+   */
+  bool arithmetic(std::uint8_t n, std::uint8_t * vx, std::uint8_t * vy, std::uint8_t * vf) {
+    for (std::size_t c = 0; c < N; c += WIDTH) {
+      Bytes x = get(vx + c);
+
+      Bytes y = get(vy + c);
+
+      switch (n) {
+        case 0x0:
+          put(vx + c, y);
+
+          break;
+
+        case 0x1:
+          put(vx + c, x | y);
+
+          break;
+
+        case 0x2:
+          put(vx + c, x & y);
+
+          break;
+
+        case 0x3:
+          put(vx + c, x ^ y);
+
+          break;
+
+        case 0x4:
+          put(vf + c, (Bytes) (x + y < x) & 1);
+
+          put(vx + c, get(vx + c) + get(vy + c));
+
+          break;
+
+        case 0x5:
+          put(vf + c, (Bytes) (x > y) & 1);
+
+          put(vx + c, get(vx + c) - get(vy + c));
+
+          break;
+
+        case 0x7:
+          put(vf + c, (Bytes) (y > x) & 1);
+
+          put(vx + c, get(vy + c) - get(vx + c));
+
+          break;
+
+        case 0xE:
+          if (quirks.shift_vy) {
+            x = y;
+          }
+
+          put(vf + c, x >> 7);
+
+          x = get(quirks.shift_vy ? vy + c : vx + c);
+
+          put(vx + c, x + x);
+
+          break;
+
+        default:
+          return false;
+      }
+
+      if (quirks.reset_vf && n >= 0x1 && n <= 0x3) {
+        put(vf + c, Bytes());
+      }
+    }
+
+    return true;
+  }
+
+  /*
+   * Run the instruction at lane's PC on its own Veranke.
+   */
+  void scalar(std::size_t lane) {
+    Veranke &machine = machines[lane];
+
+    push(lane, machine);
+
+    std::uint16_t opcode = machine.fetch();
+
+    std::uint16_t address = machine.index;
+
+    machine.run(1);
+
+    pull(lane);
+
+    std::size_t size = 0;
+
+    if ((opcode & 0xF0FF) == 0xF033) {
+      size = 3;
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+      size = ((opcode & 0x0F00) >> 0x8) + 1;
+    } else if ((opcode & 0xF00F) == 0x5002) {
+      size = (std::size_t) std::abs(((opcode & 0x0F00) >> 0x8) - ((opcode & 0x00F0) >> 0x4)) + 1;
+    }
+
+    for (std::size_t i = 0; i < size; ++i) {
+      written[(std::uint16_t) (address + i)] = 1;
+    }
+  }
+
+  /*
+   * Copy lane's registers into machine.
+   */
+  void push(std::size_t lane, Veranke &machine) const {
+    for (std::size_t r = 0; r < 16; ++r) {
+      machine.registers[r] = registers[r][lane];
+    }
+
+    machine.index = index[lane];
+
+    machine.program_counter = program_counter[lane];
+
+    machine.stack_pointer = stack_pointer[lane];
+
+    machine.delay_timer = delay_timer[lane];
+
+    machine.sound_timer = sound_timer[lane];
+  }
+
+  /*
+   * Copy lane's registers back from its Veranke.
+   */
+  void pull(std::size_t lane) {
+    const Veranke &machine = machines[lane];
+
+    for (std::size_t r = 0; r < 16; ++r) {
+      registers[r][lane] = machine.registers[r];
+    }
+
+    index[lane] = machine.index;
+
+    program_counter[lane] = machine.program_counter;
+
+    stack_pointer[lane] = machine.stack_pointer;
+
+    delay_timer[lane] = machine.delay_timer;
+
+    sound_timer[lane] = machine.sound_timer;
+  }
+
+  static Bytes get(const std::uint8_t * lanes) {
+    Bytes bytes;
+
+    std::memcpy(&bytes, lanes, WIDTH);
+
+    return bytes;
+  }
+
+  static void put(std::uint8_t * lanes, Bytes bytes) {
+    std::memcpy(lanes, &bytes, WIDTH);
+  }
+
+  static Bytes splat(std::uint8_t value) {
+    Bytes bytes;
+
+    for (std::size_t i = 0; i < WIDTH; ++i) {
+      bytes[i] = value;
+    }
+
+    return bytes;
+  }
+
+  /*
+   * The quirks of the lanes' profile, which the vector paths honour as
+   * the lanes' own handlers do.
+   */
+  Quirks quirks;
+
+  std::vector<Veranke> machines;
+
+  std::uint8_t registers[16][N];
+
+  std::uint16_t index[N];
+
+  std::uint16_t program_counter[N];
+
+  std::uint8_t stack_pointer[N];
+
+  std::uint8_t delay_timer[N];
+
+  std::uint8_t sound_timer[N];
+
+  /*
+   * Addresses any lane has stored to since the ROM was loaded.
+   */
+  std::array<std::uint8_t, 0x10000> written;
+};
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_COUNTERS_H
+
+#define VERANKE_COUNTERS_H
+
+#include <cstdint>
+
+#if defined(__linux__)
+#define VERANKE_COUNTERS 1
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define VERANKE_COUNTERS 0
+#endif
+
+/*
+ * Hardware performance counters for this thread, read through Linux's
+ * perf_event_open around a stretch of code, e.g., a benchmark run.
+ *
+ * Each event is opened on its own, so a host that lacks one (e.g., L1d
+ * misses in many virtual machines) still gets the rest, and a host that
+ * allows none (e.g., a container, or perf_event_paranoid set too high)
+ * gets none without failing. Only user-space events are counted. When the
+ * kernel multiplexes more events than the core has counters, counts are
+ * scaled up by the share of time each was running.
+ */
+class Counters {
+public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    EVENTS
+  };
+
+  Counters() {
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      descriptors[i] = -1;
+
+      values[i] = 0;
+    }
+
+#if VERANKE_COUNTERS
+    static const std::uint32_t types[] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+
+    static const std::uint64_t configs[] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+    };
+
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      struct perf_event_attr attributes;
+
+      std::memset(&attributes, 0, sizeof(attributes));
+
+      attributes.size = sizeof(attributes);
+
+      attributes.type = types[i];
+
+      attributes.config = configs[i];
+
+      attributes.disabled = 1;
+
+      attributes.exclude_kernel = 1;
+
+      attributes.exclude_hv = 1;
+
+      attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      descriptors[i] = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    }
+#endif
+  }
+
+  ~Counters() {
+#if VERANKE_COUNTERS
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      if (descriptors[i] >= 0) {
+        close(descriptors[i]);
+      }
+    }
+#endif
+  }
+
+  static const char * event_name(Event event) {
+    static const char * names[] = {"cycles", "instructions", "branch-misses", "L1d-misses"};
+
+    return names[event];
+  }
+
+  /*
+   * Whether any counter could be opened.
+   */
+  bool available(void) const {
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      if (descriptors[i] >= 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool available(Event event) const {
+    return descriptors[event] >= 0;
+  }
+
+  /*
+   * Zero the counters and start counting.
+   */
+  void start(void) {
+#if VERANKE_COUNTERS
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      if (descriptors[i] >= 0) {
+        ioctl(descriptors[i], PERF_EVENT_IOC_RESET, 0);
+
+        ioctl(descriptors[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  /*
+   * Stop counting and read what was counted since start. An event that
+   * cannot be read is marked unavailable.
+   */
+  void stop(void) {
+#if VERANKE_COUNTERS
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      if (descriptors[i] >= 0) {
+        ioctl(descriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+
+    for (std::size_t i = 0; i < EVENTS; ++i) {
+      if (descriptors[i] < 0) {
+        continue;
+      }
+
+      /*
+       * The count, then the time enabled and the time running.
+       */
+      std::uint64_t data[3];
+
+      if (read(descriptors[i], data, sizeof(data)) != (ssize_t) sizeof(data)) {
+        close(descriptors[i]);
+
+        descriptors[i] = -1;
+
+        continue;
+      }
+
+      values[i] = data[2] > 0 && data[2] < data[1] ? (std::uint64_t) ((double) data[0] * data[1] / data[2]) : data[0];
+    }
+#endif
+  }
+
+  /*
+   * What event counted between the last start and stop.
+   */
+  std::uint64_t value(Event event) const {
+    return values[event];
+  }
+
+private:
+  int descriptors[EVENTS];
+
+  std::uint64_t values[EVENTS];
+};
+
+#endif
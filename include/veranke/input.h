@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_INPUT_H
+
+#define VERANKE_INPUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * The sixteen CHIP-8 keys held down, one bit per key (bit 0 is key 0).
+ *
+ * Any source (e.g., SDL events, a replay file, or a remote controller)
+ * presses and releases keys from its own thread; the emulator thread reads
+ * the whole keypad with state() once per frame. Neither side locks, except
+ * that an emulator thread with nothing to do can park in wait until a key
+ * goes down.
+ */
+class Input {
+public:
+  Input(): keys(0), woken(false) {
+  }
+
+  void press(std::uint8_t key) {
+    keys.fetch_or((std::uint16_t) (1 << (key & 0xF)), std::memory_order_relaxed);
+
+    notify();
+  }
+
+  void release(std::uint8_t key) {
+    keys.fetch_and((std::uint16_t) ~(1 << (key & 0xF)), std::memory_order_relaxed);
+  }
+
+  /*
+   * Replace every key at once, e.g., with a recorded frame's keypad.
+   */
+  void set(std::uint16_t state) {
+    keys.store(state, std::memory_order_relaxed);
+
+    if (state != 0) {
+      notify();
+    }
+  }
+
+  std::uint16_t state(void) const {
+    return keys.load(std::memory_order_relaxed);
+  }
+
+  /*
+   * Block until a key is down or wake is called.
+   */
+  void wait(void) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (state() == 0 && !woken) {
+      pressed.wait(lock);
+    }
+
+    woken = false;
+  }
+
+  /*
+   * Release a thread blocked in wait, e.g., to shut it down.
+   */
+  void wake(void) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    woken = true;
+
+    pressed.notify_all();
+  }
+
+private:
+  /*
+   * The lock orders the change before a waiter's check, so a key pressed
+   * just as the emulator thread parks still wakes it.
+   */
+  void notify(void) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    pressed.notify_all();
+  }
+
+  std::atomic<std::uint16_t> keys;
+
+  std::mutex mutex;
+
+  std::condition_variable pressed;
+
+  bool woken;
+};
+
+#endif
@@ -0,0 +1,778 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_JIT_H
+
+#define VERANKE_JIT_H
+
+#include "veranke.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define VERANKE_JIT 1
+#include <sys/mman.h>
+#else
+#define VERANKE_JIT 0
+#endif
+
+/*
+ * A basic-block recompiler from CHIP-8 to x86-64.
+ *
+ * A block is the straight-line run of instructions starting at some
+ * address, up to and including the first instruction that can transfer
+ * control: 1nnn, 2nnn, RET (any 0nEE), Bnnn, the skips, and unknown
+ * opcodes. EXIT (any 0nFD) and XO-CHIP's four-byte F000 nnnn end a block
+ * too. Each block becomes a native function that takes the machine in rdi
+ * and returns the number of instructions it executed. Only the first 4K of
+ * memory is translated; code past it is interpreted.
+ *
+ * Register-only instructions (6xkk, 7xkk, most of 8xy*, Annn, and the
+ * timer and I arithmetic in Fx**) operate directly on the machine's
+ * registers array, which is pinned in rbx for the life of the block. The
+ * program counter is only stored when something can observe it. Every
+ * other instruction calls the interpreter's handler for the machine's
+ * quirk profile, so the two cores share their semantics.
+ *
+ * A write into a byte covered by translated blocks (see
+ * Veranke::invalidate) discards those blocks. Blocks that contain Fx33 or
+ * Fx55 check for a discard after the write and return early, so a block
+ * never runs past an instruction it has overwritten. Code space is only
+ * reclaimed when the buffer fills up and the whole cache is flushed.
+ */
+class Jit {
+public:
+  typedef std::uint32_t (*Block)(Veranke *);
+
+  /*
+   * Blocks are cut after this many instructions so that a block always
+   * fits in the space reserved for it.
+   */
+  static const std::size_t MAXIMUM_BLOCK_LENGTH = 64;
+
+  /*
+   * The bytes a block covers: its instructions and, after a skip, the
+   * instruction it may skip, whose length decides where it lands.
+   */
+  static const std::size_t MAXIMUM_BLOCK_SIZE = (MAXIMUM_BLOCK_LENGTH + 1) * 2;
+
+  static const std::size_t MAXIMUM_INSTRUCTION_SIZE = 64;
+
+  static const std::size_t CAPACITY = 1 << 20;
+
+  explicit Jit(const Veranke &veranke): code(0), cursor(0), discarded(0), operands(CAPACITY / MAXIMUM_INSTRUCTION_SIZE), profile(veranke.profile), quirks(Veranke::quirks(veranke.profile)) {
+#if VERANKE_JIT
+    void * pages = mmap(0, CAPACITY, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (pages != MAP_FAILED) {
+      code = (std::uint8_t *) pages;
+    }
+#endif
+
+    const char * base = (const char *) &veranke;
+
+    delay_timer = (std::int32_t) ((const char *) &veranke.delay_timer - base);
+
+    index = (std::int32_t) ((const char *) &veranke.index - base);
+
+    program_counter = (std::int32_t) ((const char *) &veranke.program_counter - base);
+
+    registers = (std::int32_t) ((const char *) &veranke.registers[0] - base);
+
+    sound_timer = (std::int32_t) ((const char *) &veranke.sound_timer - base);
+
+    flush();
+  }
+
+  ~Jit() {
+#if VERANKE_JIT
+    if (code) {
+      munmap(code, CAPACITY);
+    }
+#endif
+  }
+
+  /*
+   * Whether native code can be generated on this host. When it cannot
+   * (e.g., the system refuses writable and executable pages), the JIT core
+   * runs the PREDECODED core instead.
+   */
+  bool usable(void) const {
+    return code != 0;
+  }
+
+  /*
+   * Execute exactly n instructions. A block longer than what is left of
+   * the budget is not entered; the remaining instructions are interpreted
+   * one at a time instead.
+   */
+  std::size_t run(Veranke &veranke, std::size_t n) {
+    std::size_t executed = 0;
+
+    while (executed < n && !veranke.waiting) {
+      std::uint16_t address = veranke.program_counter;
+
+      if (address > 0xFFE) {
+        veranke.step();
+
+        ++executed;
+
+        continue;
+      }
+
+      Entry &entry = entries[address];
+
+      if (entry.block == 0) {
+        translate(veranke, address);
+      }
+
+      if (entry.idle) {
+        std::size_t skipped = veranke.fast_forward(n - executed);
+
+        if (skipped > 0) {
+          executed += skipped;
+
+          continue;
+        }
+      }
+
+      if (entry.length > n - executed) {
+        veranke.step();
+
+        ++executed;
+
+        continue;
+      }
+
+      discarded = 0;
+
+      executed += entry.block(&veranke);
+    }
+
+    return executed;
+  }
+
+  /*
+   * Discard every block that covers address.
+   */
+  void invalidate(std::size_t address) {
+    if (address >= covered.size() || covered[address] == 0) {
+      return;
+    }
+
+    std::size_t first = address > MAXIMUM_BLOCK_SIZE ? address - MAXIMUM_BLOCK_SIZE : 0;
+
+    for (std::size_t start = first; start <= address; ++start) {
+      Entry &entry = entries[start];
+
+      if (entry.block != 0 && address < entry.end) {
+        for (std::size_t i = start; i < entry.end; ++i) {
+          --covered[i];
+        }
+
+        entry.block = 0;
+
+        entry.length = 0;
+
+        discarded = 1;
+      }
+    }
+  }
+
+  /*
+   * Discard every block. Code already running is left intact until the
+   * next translation, which only happens between blocks.
+   */
+  void flush(void) {
+    Entry entry = {0, 0, 0, false};
+
+    entries.fill(entry);
+
+    covered.fill(0);
+
+    cursor = 0;
+
+    operands_used = 0;
+
+    discarded = 1;
+  }
+
+private:
+  struct Entry {
+    Block block;
+
+    std::uint32_t length;
+
+    std::uint32_t end;
+
+    /*
+     * Whether the block may start an idle loop: it begins with a jump to
+     * itself or with LD Vx, DT. Translated jumps never call jp_addr, so
+     * run checks these itself.
+     */
+    bool idle;
+  };
+
+  void translate(const Veranke &veranke, std::uint16_t start) {
+    if (cursor + MAXIMUM_BLOCK_LENGTH * MAXIMUM_INSTRUCTION_SIZE > CAPACITY || operands_used + MAXIMUM_BLOCK_LENGTH > operands.size()) {
+      flush();
+    }
+
+    std::uint8_t * entry_point = code + cursor;
+
+    std::uint16_t address = start;
+
+    std::uint16_t stored = start;
+
+    std::uint32_t length = 0;
+
+    bool terminated = false;
+
+    bool skips = false;
+
+    /*
+     * push rbx; mov rbx, rdi
+     */
+    emit(0x53);
+    emit(0x48); emit(0x89); emit(0xFB);
+
+    while (!terminated && length < MAXIMUM_BLOCK_LENGTH && address <= 0xFFE) {
+      std::uint16_t opcode = (std::uint16_t) (veranke.memory[address] << 8 | veranke.memory[address + 1]);
+
+      Veranke::Operands o(opcode);
+
+      ++covered[address];
+
+      ++covered[address + 1];
+
+      ++length;
+
+      switch (opcode & 0xF000) {
+        case 0x1000:
+          store_program_counter(o.nnn);
+
+          terminated = true;
+
+          break;
+
+        case 0x3000:
+        case 0x4000:
+          store_program_counter((std::uint16_t) (address + 2));
+
+          /*
+           * cmp byte [Vx], kk
+           */
+          emit(0x80); modrm(7, registers + o.x); emit(o.kk);
+
+          skip(veranke, address, (opcode & 0xF000) == 0x3000 ? 0x75 : 0x74);
+
+          terminated = skips = true;
+
+          break;
+
+        case 0x5000:
+        case 0x9000:
+          if (o.n != 0) {
+            call(opcode, address, stored);
+
+            terminated = true;
+
+            break;
+          }
+
+          store_program_counter((std::uint16_t) (address + 2));
+
+          load(o.x);
+
+          /*
+           * cmp al, [Vy]
+           */
+          emit(0x3A); modrm(0, registers + o.y);
+
+          skip(veranke, address, (opcode & 0xF000) == 0x5000 ? 0x75 : 0x74);
+
+          terminated = skips = true;
+
+          break;
+
+        case 0x6000:
+          /*
+           * mov byte [Vx], kk
+           */
+          emit(0xC6); modrm(0, registers + o.x); emit(o.kk);
+
+          break;
+
+        case 0x7000:
+          /*
+           * add byte [Vx], kk
+           */
+          emit(0x80); modrm(0, registers + o.x); emit(o.kk);
+
+          break;
+
+        case 0x8000:
+          if (!arithmetic(o)) {
+            call(opcode, address, stored);
+
+            terminated = Veranke::decode(profile, opcode) == &Veranke::invalid;
+          }
+
+          break;
+
+        case 0xA000:
+          /*
+           * mov word [I], nnn
+           */
+          emit(0x66); emit(0xC7); modrm(0, index); emit16(o.nnn);
+
+          break;
+
+        case 0xF000:
+          if (!timers(o)) {
+            call(opcode, address, stored);
+
+            if (o.kk == 0x33 || o.kk == 0x55) {
+              check_discarded(length);
+            }
+
+            /*
+             * LD Vx, K may halt, leaving PC on itself.
+             */
+            terminated = o.kk == 0x0A || opcode == 0xF000 || Veranke::decode(profile, opcode) == &Veranke::invalid;
+          }
+
+          break;
+
+        default: {
+          call(opcode, address, stored);
+
+          /*
+           * Ask the decoder rather than matching opcodes, so every 0nEE
+           * and 0nFD ends the block, as it returns or exits on every other
+           * core.
+           */
+          Veranke::Handler handler = Veranke::decode(profile, opcode);
+
+          terminated = (opcode & 0xF000) == 0x2000 || (opcode & 0xF000) == 0xB000 || (opcode & 0xF000) == 0xE000 || handler == &Veranke::thunk<&Veranke::ret> || handler == &Veranke::thunk<&Veranke::exit> || handler == &Veranke::invalid;
+
+          break;
+        }
+      }
+
+      address = (std::uint16_t) (address + 2);
+    }
+
+    if (!terminated && stored != address) {
+      store_program_counter(address);
+    }
+
+    if (skips && address <= 0xFFE) {
+      ++covered[address];
+
+      ++covered[address + 1];
+
+      address = (std::uint16_t) (address + 2);
+    }
+
+    epilogue(length);
+
+    entries[start].block = (Block) entry_point;
+
+    entries[start].length = length;
+
+    entries[start].end = address;
+
+    std::uint16_t first = (std::uint16_t) (veranke.memory[start] << 8 | veranke.memory[start + 1]);
+
+    entries[start].idle = first == (0x1000 | start) || Veranke::decode(profile, first) == &Veranke::thunk<&Veranke::exit> || (first & 0xF0FF) == 0xF007;
+  }
+
+  /*
+   * 8xy0 through 8xy5, 8xy7, and 8xyE. VF is written before Vx is
+   * recomputed from a fresh read, matching the handlers when x or y is F.
+   */
+  bool arithmetic(const Veranke::Operands &o) {
+    std::int32_t vx = registers + o.x;
+
+    std::int32_t vy = registers + o.y;
+
+    std::int32_t vf = registers + 0xF;
+
+    switch (o.n) {
+      case 0x0:
+        load(o.y);
+
+        store(vx);
+
+        return true;
+
+      case 0x1:
+      case 0x2:
+      case 0x3: {
+        static const std::uint8_t operations[] = {0x0A, 0x22, 0x32};
+
+        load(o.x);
+
+        emit(operations[o.n - 1]); modrm(0, vy);
+
+        store(vx);
+
+        if (quirks.reset_vf) {
+          /*
+           * mov byte [VF], 0
+           */
+          emit(0xC6); modrm(0, vf); emit(0x00);
+        }
+      }
+
+        return true;
+
+      case 0x4:
+        /*
+         * mov al, [Vx]; add al, [Vy]; setc cl; mov [VF], cl
+         */
+        load(o.x);
+
+        emit(0x02); modrm(0, vy);
+
+        emit(0x0F); emit(0x92); emit(0xC1);
+
+        emit(0x88); modrm(1, vf);
+
+        load(o.x);
+
+        emit(0x02); modrm(0, vy);
+
+        store(vx);
+
+        return true;
+
+      case 0x5:
+      case 0x7: {
+        std::uint8_t minuend = o.n == 0x5 ? o.x : o.y;
+
+        std::int32_t subtrahend = o.n == 0x5 ? vy : vx;
+
+        /*
+         * mov al, [minuend]; cmp al, [subtrahend]; seta cl; mov [VF], cl
+         */
+        load(minuend);
+
+        emit(0x3A); modrm(0, subtrahend);
+
+        emit(0x0F); emit(0x97); emit(0xC1);
+
+        emit(0x88); modrm(1, vf);
+
+        load(minuend);
+
+        emit(0x2A); modrm(0, subtrahend);
+
+        store(vx);
+      }
+
+        return true;
+
+      case 0xE: {
+        std::uint8_t source = quirks.shift_vy ? o.y : o.x;
+
+        /*
+         * mov al, [source]; shr al, 7; mov [VF], al; mov al, [source];
+         * add al, al
+         */
+        load(source);
+
+        emit(0xC0); emit(0xE8); emit(0x07);
+
+        store(vf);
+
+        load(source);
+
+        emit(0x00); emit(0xC0);
+
+        store(vx);
+      }
+
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  /*
+   * Fx07, Fx15, Fx18, Fx1E, and Fx29.
+   */
+  bool timers(const Veranke::Operands &o) {
+    switch (o.kk) {
+      case 0x07:
+        emit(0x8A); modrm(0, delay_timer);
+
+        store(registers + o.x);
+
+        return true;
+
+      case 0x15:
+        load(o.x);
+
+        store(delay_timer);
+
+        return true;
+
+      case 0x18:
+        load(o.x);
+
+        store(sound_timer);
+
+        return true;
+
+      case 0x1E:
+        /*
+         * movzx eax, byte [Vx]; add [I], ax
+         */
+        emit(0x0F); emit(0xB6); modrm(0, registers + o.x);
+
+        emit(0x66); emit(0x01); modrm(0, index);
+
+        return true;
+
+      case 0x29:
+        /*
+         * movzx eax, byte [Vx]; lea eax, [rax + rax * 4]; mov [I], ax
+         */
+        emit(0x0F); emit(0xB6); modrm(0, registers + o.x);
+
+        emit(0x8D); emit(0x04); emit(0x80);
+
+        emit(0x66); emit(0x89); modrm(0, index);
+
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  /*
+   * Call the interpreter's handler for opcode with the program counter
+   * set to address, as the handler expects.
+   */
+  void call(std::uint16_t opcode, std::uint16_t address, std::uint16_t &stored) {
+    Veranke::Operands &arguments = operands[operands_used++];
+
+    arguments = Veranke::Operands(opcode);
+
+    if (stored != address) {
+      store_program_counter(address);
+    }
+
+    /*
+     * mov rdi, rbx; mov rsi, &arguments; mov rax, handler; call rax
+     */
+    emit(0x48); emit(0x89); emit(0xDF);
+
+    emit(0x48); emit(0xBE); emit64((std::uint64_t) (std::uintptr_t) &arguments);
+
+    emit(0x48); emit(0xB8); emit64((std::uint64_t) (std::uintptr_t) Veranke::decode(profile, opcode));
+
+    emit(0xFF); emit(0xD0);
+
+    stored = (std::uint16_t) (address + 2);
+  }
+
+  /*
+   * Return early, having executed length instructions, if the call just
+   * made discarded any block.
+   *
+   * mov rax, &discarded; cmp byte [rax], 0; je 1f; <epilogue>; 1:
+   */
+  void check_discarded(std::uint32_t length) {
+    emit(0x48); emit(0xB8); emit64((std::uint64_t) (std::uintptr_t) &discarded);
+
+    emit(0x80); emit(0x38); emit(0x00);
+
+    emit(0x74); emit(7);
+
+    epilogue(length);
+  }
+
+  /*
+   * The program counter has already been set to address + 2. Emit a
+   * conditional jump (jcc rel8) around the store that skips the next
+   * instruction, which is four bytes long if it is F000 nnnn.
+   */
+  void skip(const Veranke &veranke, std::uint16_t address, std::uint8_t jcc) {
+    std::uint16_t next = (std::uint16_t) (address + 2);
+
+    bool long_next = veranke.memory[next] == 0xF0 && veranke.memory[(std::uint16_t) (next + 1)] == 0x00;
+
+    emit(jcc); emit(9);
+
+    store_program_counter((std::uint16_t) (next + (long_next ? 4 : 2)));
+  }
+
+  /*
+   * mov word [PC], value (9 bytes)
+   */
+  void store_program_counter(std::uint16_t value) {
+    emit(0x66); emit(0xC7); modrm(0, program_counter); emit16(value);
+  }
+
+  /*
+   * mov al, [Vr]
+   */
+  void load(std::uint8_t r) {
+    emit(0x8A); modrm(0, registers + r);
+  }
+
+  /*
+   * mov [rbx + displacement], al
+   */
+  void store(std::int32_t displacement) {
+    emit(0x88); modrm(0, displacement);
+  }
+
+  /*
+   * mov eax, length; pop rbx; ret (7 bytes)
+   */
+  void epilogue(std::uint32_t length) {
+    emit(0xB8); emit32(length);
+
+    emit(0x5B);
+
+    emit(0xC3);
+  }
+
+  /*
+   * A ModRM byte addressing [rbx + disp32], followed by the displacement.
+   */
+  void modrm(std::uint8_t reg, std::int32_t displacement) {
+    emit((std::uint8_t) (0x83 | (reg << 3)));
+
+    emit32((std::uint32_t) displacement);
+  }
+
+  void emit(std::uint8_t value) {
+    code[cursor++] = value;
+  }
+
+  void emit16(std::uint16_t value) {
+    emit((std::uint8_t) value);
+    emit((std::uint8_t) (value >> 8));
+  }
+
+  void emit32(std::uint32_t value) {
+    emit16((std::uint16_t) value);
+    emit16((std::uint16_t) (value >> 16));
+  }
+
+  void emit64(std::uint64_t value) {
+    emit32((std::uint32_t) value);
+    emit32((std::uint32_t) (value >> 32));
+  }
+
+  std::uint8_t * code;
+
+  std::size_t cursor;
+
+  /*
+   * Set whenever a block is discarded and tested by blocks after a memory
+   * write.
+   */
+  std::uint8_t discarded;
+
+  std::array<Entry, 4096> entries;
+
+  /*
+   * How many blocks cover each byte of the first 4K of memory. Blocks span
+   * at most MAXIMUM_BLOCK_SIZE bytes, so no byte is covered by more blocks
+   * than a counter can hold.
+   */
+  std::array<std::uint8_t, 4096> covered;
+
+  /*
+   * Operands passed to handlers by translated code. Sized once so their
+   * addresses stay fixed.
+   */
+  std::vector<Veranke::Operands> operands;
+
+  std::size_t operands_used;
+
+  std::int32_t delay_timer;
+
+  std::int32_t index;
+
+  std::int32_t program_counter;
+
+  std::int32_t registers;
+
+  std::int32_t sound_timer;
+
+  Veranke::Profile profile;
+
+  Quirks quirks;
+};
+
+inline Veranke::Translations::~Translations() {
+  delete jit;
+}
+
+inline Veranke::Translations & Veranke::Translations::operator=(const Translations &) {
+  delete jit;
+
+  jit = 0;
+
+  return *this;
+}
+
+inline std::size_t Veranke::run_translations(std::size_t n) {
+  if (!translations.jit) {
+    translations.jit = new Jit(*this);
+  }
+
+  if (!translations.jit->usable()) {
+    std::size_t i = 0;
+
+    for (; i < n && !waiting; ++i) {
+      step();
+    }
+
+    return i;
+  }
+
+  return translations.jit->run(*this, n);
+}
+
+inline void Veranke::invalidate_translations(std::size_t address) {
+  translations.jit->invalidate(address);
+}
+
+inline void Veranke::invalidate_translations(void) {
+  translations.jit->flush();
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_MOVIE_H
+
+#define VERANKE_MOVIE_H
+
+#include "veranke.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/*
+ * A recorded session: the ROM it ran, everything else that decides how
+ * the machine behaves, and the keypad for every frame. Replaying it on a
+ * machine freshly loaded with the same ROM reproduces the session
+ * exactly, on any core.
+ *
+ * On disk a movie is the magic "VRKM", a version byte, the ROM hash, the
+ * seed, the instructions per frame, and the quirk profile, all
+ * little-endian, then the frames as runs: a varint count of frames and
+ * the 16-bit keypad they share, until the frame count is reached. Version
+ * 1 movies have no profile byte and were recorded with MODERN quirks.
+ */
+class Movie {
+public:
+  static const std::uint8_t VERSION = 2;
+
+  /*
+   * The most frames a movie can hold, a week at 60 Hz, so a corrupt frame
+   * count cannot make read allocate without bound.
+   */
+  static const std::uint64_t MAX_FRAMES = 7ull * 24 * 60 * 60 * 60;
+
+  Movie(): rom(0), seed(0), instructions_per_frame(0), profile(Veranke::MODERN) {
+  }
+
+  /*
+   * FNV-1a of size bytes, e.g., of the ROM, to check a movie is replayed
+   * on the ROM it was recorded on.
+   */
+  static std::uint64_t hash(const std::uint8_t * bytes, std::size_t size) {
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (std::size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+  }
+
+  bool write(std::ostream &stream) const {
+    if (frames.size() > MAX_FRAMES) {
+      return false;
+    }
+
+    stream.write("VRKM", 4);
+
+    stream.put((char) VERSION);
+
+    put(stream, rom, 8);
+
+    put(stream, seed, 8);
+
+    put(stream, instructions_per_frame, 4);
+
+    stream.put((char) profile);
+
+    varint(stream, frames.size());
+
+    for (std::size_t i = 0; i < frames.size(); ) {
+      std::size_t run = 1;
+
+      while (i + run < frames.size() && frames[i + run] == frames[i]) {
+        ++run;
+      }
+
+      varint(stream, run);
+
+      put(stream, frames[i], 2);
+
+      i += run;
+    }
+
+    return stream.good();
+  }
+
+  /*
+   * Replace this movie with one read from stream. Returns false if the
+   * stream does not hold a movie this version can read.
+   */
+  bool read(std::istream &stream) {
+    char magic[4];
+
+    if (!stream.read(magic, 4) || magic[0] != 'V' || magic[1] != 'R' || magic[2] != 'K' || magic[3] != 'M') {
+      return false;
+    }
+
+    int version = stream.get();
+
+    if (version < 1 || version > VERSION) {
+      return false;
+    }
+
+    rom = get(stream, 8);
+
+    seed = get(stream, 8);
+
+    instructions_per_frame = (std::uint32_t) get(stream, 4);
+
+    profile = Veranke::MODERN;
+
+    if (version >= 2) {
+      int byte = stream.get();
+
+      if (byte < Veranke::MODERN || byte > Veranke::SCHIP) {
+        return false;
+      }
+
+      profile = (Veranke::Profile) byte;
+    }
+
+    std::uint64_t count = read_varint(stream);
+
+    frames.clear();
+
+    if (count > MAX_FRAMES) {
+      return false;
+    }
+
+    while (stream && frames.size() < count) {
+      std::uint64_t run = read_varint(stream);
+
+      std::uint16_t keys = (std::uint16_t) get(stream, 2);
+
+      if (run == 0 || run > count - frames.size()) {
+        return false;
+      }
+
+      frames.insert(frames.end(), (std::size_t) run, keys);
+    }
+
+    return (bool) stream;
+  }
+
+  /*
+   * Run the whole movie on veranke, which must be freshly loaded with the
+   * movie's ROM and constructed with its seed and profile, as fast as the
+   * core allows. Returns the instructions executed.
+   */
+  std::uint64_t replay(Veranke &veranke) const {
+    std::uint64_t executed = 0;
+
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+      veranke.keypad = frames[i];
+
+      executed += veranke.run(instructions_per_frame);
+
+      veranke.tick();
+    }
+
+    return executed;
+  }
+
+  std::uint64_t rom;
+
+  std::uint64_t seed;
+
+  std::uint32_t instructions_per_frame;
+
+  Veranke::Profile profile;
+
+  /*
+   * The keypad during each frame.
+   */
+  std::vector<std::uint16_t> frames;
+
+private:
+  static void put(std::ostream &stream, std::uint64_t value, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      stream.put((char) (value >> (8 * i)));
+    }
+  }
+
+  static std::uint64_t get(std::istream &stream, std::size_t size) {
+    std::uint64_t value = 0;
+
+    for (std::size_t i = 0; i < size; ++i) {
+      value |= (std::uint64_t) (std::uint8_t) stream.get() << (8 * i);
+    }
+
+    return value;
+  }
+
+  static void varint(std::ostream &stream, std::uint64_t value) {
+    while (value >= 0x80) {
+      stream.put((char) (value | 0x80));
+
+      value >>= 7;
+    }
+
+    stream.put((char) value);
+  }
+
+  static std::uint64_t read_varint(std::istream &stream) {
+    std::uint64_t value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      int byte = stream.get();
+
+      if (byte == std::char_traits<char>::eof()) {
+        break;
+      }
+
+      value |= (std::uint64_t) (byte & 0x7F) << shift;
+
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+
+    return value;
+  }
+};
+
+#endif
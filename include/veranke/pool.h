@@ -0,0 +1,218 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_POOL_H
+
+#define VERANKE_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A work-stealing thread pool for independent jobs of very uneven length
+ * (e.g., one ROM that halts at once next to one that runs its whole
+ * budget).
+ *
+ * Submitted tasks are dealt round-robin onto per-worker queues. A worker
+ * takes from the back of its own queue and, once that is empty, steals
+ * from the front of the others', so no worker idles while any queue still
+ * holds work. Each queue has its own lock, so workers only contend when
+ * one of them is stealing. The pool-wide lock is only taken to sleep once
+ * every queue is empty, and by submit to wake a sleeper.
+ */
+class Pool {
+public:
+  typedef std::function<void (void)> Task;
+
+  explicit Pool(std::size_t threads = std::thread::hardware_concurrency()): next(0), queued(0), pending(0), stopping(false) {
+    if (threads == 0) {
+      threads = 1;
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+      queues.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+      workers.push_back(std::thread(&Pool::work, this, i));
+    }
+  }
+
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      stopping = true;
+    }
+
+    available.notify_all();
+
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+    }
+  }
+
+  /*
+   * Queue a task. Tasks are submitted from one thread.
+   */
+  void submit(Task task) {
+    Queue &queue = *queues[next++ % queues.size()];
+
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+
+      queue.tasks.push_back(task);
+    }
+
+    queued.fetch_add(1, std::memory_order_release);
+
+    /*
+     * A worker that found nothing queued either sleeps already, and is
+     * woken, or takes the lock after this and sees the task.
+     */
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+
+    available.notify_one();
+  }
+
+  /*
+   * Block until every submitted task has finished.
+   */
+  void wait(void) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (pending.load(std::memory_order_acquire) != 0) {
+      finished.wait(lock);
+    }
+  }
+
+  std::size_t size(void) const {
+    return workers.size();
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+
+    std::deque<Task> tasks;
+  };
+
+  void work(std::size_t self) {
+    for (;;) {
+      Task task;
+
+      if (take(self, task)) {
+        task();
+
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          std::lock_guard<std::mutex> lock(mutex);
+
+          finished.notify_all();
+        }
+
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      while (queued.load(std::memory_order_acquire) == 0 && !stopping) {
+        available.wait(lock);
+      }
+
+      if (queued.load(std::memory_order_acquire) == 0 && stopping) {
+        return;
+      }
+    }
+  }
+
+  /*
+   * Take a task from the back of this worker's queue, or steal one from
+   * the front of another's.
+   */
+  bool take(std::size_t self, Task &task) {
+    for (std::size_t i = 0; i < queues.size(); ++i) {
+      Queue &queue = *queues[(self + i) % queues.size()];
+
+      std::lock_guard<std::mutex> lock(queue.mutex);
+
+      if (queue.tasks.empty()) {
+        continue;
+      }
+
+      if (i == 0) {
+        task = queue.tasks.back();
+
+        queue.tasks.pop_back();
+      } else {
+        task = queue.tasks.front();
+
+        queue.tasks.pop_front();
+      }
+
+      queued.fetch_sub(1, std::memory_order_relaxed);
+
+      return true;
+    }
+
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Queue> > queues;
+
+  std::vector<std::thread> workers;
+
+  std::size_t next;
+
+  /*
+   * Tasks waiting in some queue. Workers decrement it without the lock;
+   * submit takes the lock after incrementing it, so an idle worker cannot
+   * miss a task being submitted.
+   */
+  std::atomic<std::size_t> queued;
+
+  /*
+   * Tasks submitted and not yet finished.
+   */
+  std::atomic<std::size_t> pending;
+
+  bool stopping;
+
+  std::mutex mutex;
+
+  std::condition_variable available;
+
+  std::condition_variable finished;
+};
+
+#endif
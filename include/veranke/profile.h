@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_PROFILE_H
+
+#define VERANKE_PROFILE_H
+
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * Profiling builds (-DVERANKE_PROFILE=1, or the VERANKE_PROFILE CMake
+ * option) count every instruction a machine executes. Other builds get an
+ * empty Profiler whose hooks compile to nothing.
+ */
+#ifndef VERANKE_PROFILE
+#define VERANKE_PROFILE 0
+#endif
+
+#if VERANKE_PROFILE
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Where a guest program spends its time: instructions executed per opcode
+ * class, per address, and per call-stack depth, and sprite pixels drawn.
+ * Each instruction is also counted against its call stack (the return
+ * addresses on the machine's stack, then the address executing), which
+ * collapse writes in the folded format flame graph tools read.
+ */
+class Profiler {
+public:
+  static const bool ENABLED = true;
+
+  Profiler(): addresses(0x10000) {
+    reset();
+  }
+
+  void reset(void) {
+    classes.fill(0);
+
+    std::fill(addresses.begin(), addresses.end(), 0);
+
+    depths.fill(0);
+
+    instructions = 0;
+
+    pixels = 0;
+
+    stacks.clear();
+  }
+
+  /*
+   * Count the length instructions from address in memory, as executed
+   * times times each with depth return addresses on stack.
+   */
+  void count(const std::uint8_t * memory, std::uint16_t address, const std::uint16_t * stack, std::size_t depth, std::size_t length = 1, std::uint64_t times = 1) {
+    depth = std::min(depth, (std::size_t) 16);
+
+    for (std::size_t i = 0; i < length; ++i) {
+      std::uint16_t here = (std::uint16_t) (address + i * 2);
+
+      classes[memory[here] >> 4] += times;
+
+      addresses[here] += times;
+
+      std::uint64_t key = 0xCBF29CE484222325ull;
+
+      for (std::size_t j = 0; j < depth; ++j) {
+        key = (key ^ stack[j]) * 0x100000001B3ull;
+      }
+
+      key = (key ^ (0x10000u | here)) * 0x100000001B3ull;
+
+      Stack &entry = stacks[key];
+
+      if (entry.count == 0) {
+        std::copy(stack, stack + depth, entry.frames.begin());
+
+        entry.depth = (std::uint8_t) depth;
+
+        entry.leaf = here;
+      }
+
+      entry.count += times;
+    }
+
+    depths[depth] += times * length;
+
+    instructions += times * length;
+  }
+
+  /*
+   * Count the pixels of one sprite row DRW draws, in its leftmost bits.
+   */
+  void sprite(std::uint64_t row) {
+    pixels += (std::uint64_t) __builtin_popcountll(row);
+  }
+
+  /*
+   * Write the opcode classes and the top hottest addresses, most executed
+   * first, then the call depths and the pixels drawn.
+   */
+  void report(std::FILE * file, std::size_t top = 32) const {
+    static const char * names[] = {"0nnn SYS, CLS, RET, scrolls", "1nnn JP", "2nnn CALL", "3xkk SE", "4xkk SNE", "5xy* SE, ranges", "6xkk LD", "7xkk ADD", "8xy* ALU", "9xy0 SNE", "Annn LD I", "Bnnn JP V0", "Cxkk RND", "Dxyn DRW", "Ex** SKP, SKNP", "Fx** timers, memory"};
+
+    double total = instructions > 0 ? (double) instructions : 1;
+
+    std::fprintf(file, "%llu instructions, %llu sprite pixels drawn\n\n", (unsigned long long) instructions, (unsigned long long) pixels);
+
+    std::vector<std::size_t> order;
+
+    for (std::size_t i = 0; i < classes.size(); ++i) {
+      if (classes[i] > 0) {
+        order.push_back(i);
+      }
+    }
+
+    std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+      return classes[a] != classes[b] ? classes[a] > classes[b] : a < b;
+    });
+
+    std::fprintf(file, "%14s %7s  %s\n", "instructions", "share", "class");
+
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      std::fprintf(file, "%14llu %6.2f%%  %s\n", (unsigned long long) classes[order[i]], 100 * classes[order[i]] / total, names[order[i]]);
+    }
+
+    order.clear();
+
+    for (std::size_t i = 0; i < addresses.size(); ++i) {
+      if (addresses[i] > 0) {
+        order.push_back(i);
+      }
+    }
+
+    std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+      return addresses[a] != addresses[b] ? addresses[a] > addresses[b] : a < b;
+    });
+
+    if (order.size() > top) {
+      order.resize(top);
+    }
+
+    std::fprintf(file, "\n%14s %7s  %s\n", "instructions", "share", "address");
+
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      std::fprintf(file, "%14llu %6.2f%%  %04zX\n", (unsigned long long) addresses[order[i]], 100 * addresses[order[i]] / total, order[i]);
+    }
+
+    std::fprintf(file, "\n%14s %7s  %s\n", "instructions", "share", "call depth");
+
+    for (std::size_t i = 0; i < depths.size(); ++i) {
+      if (depths[i] > 0) {
+        std::fprintf(file, "%14llu %6.2f%%  %zu\n", (unsigned long long) depths[i], 100 * depths[i] / total, i);
+      }
+    }
+  }
+
+  /*
+   * Write one line per call stack seen: its return addresses, outermost
+   * first, then the address executing, separated by semicolons, then the
+   * instructions executed there.
+   */
+  void collapse(std::FILE * file) const {
+    for (std::unordered_map<std::uint64_t, Stack>::const_iterator i = stacks.begin(); i != stacks.end(); ++i) {
+      const Stack &stack = i->second;
+
+      for (std::size_t j = 0; j < stack.depth; ++j) {
+        std::fprintf(file, "%04X;", stack.frames[j]);
+      }
+
+      std::fprintf(file, "%04X %llu\n", stack.leaf, (unsigned long long) stack.count);
+    }
+  }
+
+  /*
+   * Instructions executed per opcode class, i.e., per opcode's top nibble.
+   */
+  std::array<std::uint64_t, 16> classes;
+
+  /*
+   * Instructions executed at each address.
+   */
+  std::vector<std::uint64_t> addresses;
+
+  /*
+   * Instructions executed with each number of return addresses on the
+   * stack.
+   */
+  std::array<std::uint64_t, 17> depths;
+
+  std::uint64_t instructions;
+
+  std::uint64_t pixels;
+
+private:
+  struct Stack {
+    Stack(): depth(0), leaf(0), count(0) {
+    }
+
+    std::array<std::uint16_t, 16> frames;
+
+    std::uint8_t depth;
+
+    std::uint16_t leaf;
+
+    std::uint64_t count;
+  };
+
+  /*
+   * Keyed by a hash of the return addresses and the address executing.
+   */
+  std::unordered_map<std::uint64_t, Stack> stacks;
+};
+
+#else
+
+class Profiler {
+public:
+  static const bool ENABLED = false;
+
+  void reset(void) {
+  }
+
+  void count(const std::uint8_t *, std::uint16_t, const std::uint16_t *, std::size_t, std::size_t = 1, std::uint64_t = 1) {
+  }
+
+  void sprite(std::uint64_t) {
+  }
+
+  void report(std::FILE *, std::size_t = 32) const {
+  }
+
+  void collapse(std::FILE *) const {
+  }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_QUIRKS_H
+
+#define VERANKE_QUIRKS_H
+
+/*
+ * The behaviours CHIP-8 interpreters have historically disagreed on. A
+ * program written for one interpreter may misbehave on another, so the
+ * core is specialized on a policy that fixes each of them at compile
+ * time. A policy is a struct of constants:
+ *
+ * SHIFT_VY: 8xy6 and 8xyE shift Vy into Vx, rather than shifting Vx in
+ * place.
+ *
+ * INCREMENT_I: Fx55 and Fx65 leave I pointing past the last register
+ * stored or loaded, rather than unchanged.
+ *
+ * JUMP_VX: Bnnn jumps to nnn plus Vx, where x is the top nibble of nnn,
+ * rather than to nnn plus V0.
+ *
+ * RESET_VF: 8xy1, 8xy2, and 8xy3 set VF to 0.
+ *
+ * CLIP: sprites are clipped at the edges of the display, rather than
+ * wrapped around to the opposite side. A sprite's starting position wraps
+ * either way.
+ */
+
+/*
+ * What most modern programs and test suites assume, and what Veranke has
+ * always done.
+ */
+struct ModernQuirks {
+  static const bool SHIFT_VY = false;
+
+  static const bool INCREMENT_I = false;
+
+  static const bool JUMP_VX = false;
+
+  static const bool RESET_VF = false;
+
+  static const bool CLIP = false;
+};
+
+/*
+ * The original COSMAC VIP interpreter.
+ */
+struct CosmacQuirks {
+  static const bool SHIFT_VY = true;
+
+  static const bool INCREMENT_I = true;
+
+  static const bool JUMP_VX = false;
+
+  static const bool RESET_VF = true;
+
+  static const bool CLIP = true;
+};
+
+/*
+ * SUPER-CHIP 1.1 on the HP-48.
+ */
+struct SchipQuirks {
+  static const bool SHIFT_VY = false;
+
+  static const bool INCREMENT_I = false;
+
+  static const bool JUMP_VX = true;
+
+  static const bool RESET_VF = false;
+
+  static const bool CLIP = true;
+};
+
+/*
+ * A policy's constants as values, for code that chooses between profiles
+ * at run time, e.g., a code generator.
+ */
+struct Quirks {
+  bool shift_vy;
+
+  bool increment_i;
+
+  bool jump_vx;
+
+  bool reset_vf;
+
+  bool clip;
+};
+
+template <class Q>
+inline Quirks quirks_of(void) {
+  Quirks quirks = {Q::SHIFT_VY, Q::INCREMENT_I, Q::JUMP_VX, Q::RESET_VF, Q::CLIP};
+
+  return quirks;
+}
+
+#endif
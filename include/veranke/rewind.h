@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_REWIND_H
+
+#define VERANKE_REWIND_H
+
+#include "veranke.h"
+
+#include <cstring>
+#include <vector>
+
+/*
+ * A fixed-size history of machine states to step back through.
+ *
+ * Only the newest state is kept whole. Every older one is stored as the
+ * XOR of it and the state after it, which is almost all zero bytes from
+ * one frame to the next, and run-length encoded: a varint count of zero
+ * bytes, a varint count of literal bytes, then the literals, repeated.
+ * Records live in a byte ring, each framed by its length at both ends so
+ * the oldest can be dropped from the tail and the newest popped from the
+ * head; when the ring is full the oldest points are forgotten.
+ */
+class Rewind {
+public:
+  static const std::size_t DEFAULT_CAPACITY = 256 * 1024;
+
+  explicit Rewind(std::size_t capacity = DEFAULT_CAPACITY): ring(capacity), head(0), used(0), records(0), empty(true) {
+  }
+
+  /*
+   * Record state as the newest rewind point.
+   */
+  void push(const MachineState &state) {
+    if (empty) {
+      std::memcpy(&newest, &state, sizeof(MachineState));
+
+      empty = false;
+
+      return;
+    }
+
+    encode((const std::uint8_t *) &state, (const std::uint8_t *) &newest);
+
+    std::memcpy(&newest, &state, sizeof(MachineState));
+
+    std::size_t size = scratch.size() + 2 * sizeof(std::uint32_t);
+
+    if (size > ring.size()) {
+      clear_history();
+
+      return;
+    }
+
+    while (ring.size() - used < size) {
+      drop_oldest();
+    }
+
+    put_length((std::uint32_t) scratch.size());
+
+    for (std::size_t i = 0; i < scratch.size(); ++i) {
+      put(scratch[i]);
+    }
+
+    put_length((std::uint32_t) scratch.size());
+
+    used += size;
+
+    ++records;
+  }
+
+  /*
+   * Step back to the point before the newest, which becomes the newest,
+   * and copy it into state. Returns false, leaving state untouched, if
+   * there is nothing older to go back to.
+   */
+  bool rewind(MachineState &state) {
+    if (records == 0) {
+      return false;
+    }
+
+    std::uint32_t length = get_length(head - sizeof(std::uint32_t));
+
+    std::size_t start = head + ring.size() - length - sizeof(std::uint32_t);
+
+    decode(start, length, (std::uint8_t *) &newest);
+
+    std::size_t size = length + 2 * sizeof(std::uint32_t);
+
+    head = (head + ring.size() - size) % ring.size();
+
+    used -= size;
+
+    --records;
+
+    std::memcpy(&state, &newest, sizeof(MachineState));
+
+    return true;
+  }
+
+  /*
+   * How many times rewind can step back.
+   */
+  std::size_t size(void) const {
+    return records;
+  }
+
+  /*
+   * Bytes of the ring holding deltas.
+   */
+  std::size_t bytes(void) const {
+    return used;
+  }
+
+  void clear(void) {
+    clear_history();
+
+    empty = true;
+  }
+
+private:
+  /*
+   * Encode newer XOR older into scratch.
+   */
+  void encode(const std::uint8_t * newer, const std::uint8_t * older) {
+    scratch.clear();
+
+    std::size_t i = 0;
+
+    while (i < sizeof(MachineState)) {
+      std::size_t zeros = 0;
+
+      while (i + zeros < sizeof(MachineState) && newer[i + zeros] == older[i + zeros]) {
+        ++zeros;
+      }
+
+      i += zeros;
+
+      std::size_t literals = 0;
+
+      while (i + literals < sizeof(MachineState) && newer[i + literals] != older[i + literals]) {
+        ++literals;
+      }
+
+      varint(zeros);
+
+      varint(literals);
+
+      for (std::size_t j = 0; j < literals; ++j) {
+        scratch.push_back(newer[i + j] ^ older[i + j]);
+      }
+
+      i += literals;
+    }
+  }
+
+  /*
+   * XOR the length-byte record starting at ring offset start into state.
+   */
+  void decode(std::size_t start, std::size_t length, std::uint8_t * state) const {
+    std::size_t offset = start;
+
+    std::size_t end = start + length;
+
+    std::size_t i = 0;
+
+    while (offset < end) {
+      i += read_varint(offset);
+
+      std::size_t literals = read_varint(offset);
+
+      for (std::size_t j = 0; j < literals; ++j) {
+        state[i++] ^= ring[offset++ % ring.size()];
+      }
+    }
+  }
+
+  void varint(std::size_t value) {
+    while (value >= 0x80) {
+      scratch.push_back((std::uint8_t) (value | 0x80));
+
+      value >>= 7;
+    }
+
+    scratch.push_back((std::uint8_t) value);
+  }
+
+  std::size_t read_varint(std::size_t &offset) const {
+    std::size_t value = 0;
+
+    for (unsigned shift = 0; ; shift += 7) {
+      std::uint8_t byte = ring[offset++ % ring.size()];
+
+      value |= (std::size_t) (byte & 0x7F) << shift;
+
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+  }
+
+  void put(std::uint8_t byte) {
+    ring[head] = byte;
+
+    head = (head + 1) % ring.size();
+  }
+
+  void put_length(std::uint32_t length) {
+    for (std::size_t i = 0; i < sizeof(length); ++i) {
+      put((std::uint8_t) (length >> (8 * i)));
+    }
+  }
+
+  /*
+   * The length stored at ring offset, which may be past the end or, as
+   * an unsigned difference, before the start of the ring.
+   */
+  std::uint32_t get_length(std::size_t offset) const {
+    std::uint32_t length = 0;
+
+    for (std::size_t i = 0; i < sizeof(length); ++i) {
+      length |= (std::uint32_t) ring[(offset + ring.size() + i) % ring.size()] << (8 * i);
+    }
+
+    return length;
+  }
+
+  void drop_oldest(void) {
+    std::size_t tail = (head + ring.size() - used) % ring.size();
+
+    std::size_t size = get_length(tail) + 2 * sizeof(std::uint32_t);
+
+    used -= size;
+
+    --records;
+  }
+
+  void clear_history(void) {
+    head = 0;
+
+    used = 0;
+
+    records = 0;
+  }
+
+  std::vector<std::uint8_t> ring;
+
+  std::vector<std::uint8_t> scratch;
+
+  std::size_t head;
+
+  std::size_t used;
+
+  std::size_t records;
+
+  bool empty;
+
+  MachineState newest;
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_SCHEDULER_H
+
+#define VERANKE_SCHEDULER_H
+
+#include "veranke.h"
+
+#include <chrono>
+#include <functional>
+#include <thread>
+
+/*
+ * Drives a Veranke one 60 Hz frame at a time, so that CPU speed, timers,
+ * and presentation no longer depend on how fast the host runs.
+ *
+ * A frame is a configurable number of instructions, then its audio, then
+ * one timer tick, then at most one presentation. In FIXED mode frames are
+ * paced by the host clock at 60 per second and every changed frame is
+ * presented. In TURBO mode frames run back to back as fast as the host
+ * allows, and changed frames are only presented as often as a 60 Hz
+ * display could show them; the rest are skipped, their damage carried
+ * over to the next frame that is presented.
+ */
+class Scheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  typedef std::function<void (const Veranke &)> Presenter;
+
+  /*
+   * Called before every frame to set its input, e.g., the keypad, from a
+   * live source or a recording.
+   */
+  typedef std::function<void (Veranke &)> Feeder;
+
+  enum Mode {
+    FIXED,
+    TURBO
+  };
+
+  /*
+   * COSMAC VIP programs expect roughly 500 to 700 instructions per second.
+   */
+  static const std::size_t DEFAULT_INSTRUCTIONS_PER_FRAME = 11;
+
+  /*
+   * How many overdue frames FIXED mode runs to catch up before it gives up
+   * on them, e.g., after the host was suspended.
+   */
+  static const std::size_t MAXIMUM_CATCH_UP = 4;
+
+  Scheduler(Veranke &veranke, Presenter present, std::size_t instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME, Mode mode = FIXED): veranke(veranke), present(present), instructions_per_frame(instructions_per_frame), mode(mode), frames(0), presented(0), skipped(0), period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / 60))), deadline(Clock::now()), next_present(deadline) {
+  }
+
+  /*
+   * Run one frame.
+   */
+  void run_frame(void) {
+    if (feed) {
+      feed(veranke);
+    }
+
+    veranke.run(instructions_per_frame);
+
+    if (listen) {
+      listen(veranke);
+    }
+
+    veranke.tick();
+
+    ++frames;
+
+    if (!veranke.changed()) {
+      return;
+    }
+
+    if (mode == TURBO) {
+      Clock::time_point now = Clock::now();
+
+      if (now < next_present) {
+        ++skipped;
+
+        return;
+      }
+
+      next_present = now + period;
+    }
+
+    if (present) {
+      present(veranke);
+    }
+
+    veranke.presented();
+
+    ++presented;
+  }
+
+  /*
+   * Run the frames that are due: in FIXED mode those whose time has come by
+   * the host clock, in TURBO mode exactly one. Returns how many ran.
+   */
+  std::size_t advance(void) {
+    if (mode == TURBO) {
+      run_frame();
+
+      return 1;
+    }
+
+    Clock::time_point now = Clock::now();
+
+    std::size_t due = 0;
+
+    while (deadline <= now && due < MAXIMUM_CATCH_UP) {
+      run_frame();
+
+      deadline += period;
+
+      ++due;
+    }
+
+    if (deadline <= now) {
+      deadline = now + period;
+    }
+
+    return due;
+  }
+
+  /*
+   * Whether running more frames would change nothing until a key is
+   * pressed: the machine is halted in LD Vx, K, no key is down, both timers
+   * have run out, and the display has been presented. A host can park the
+   * emulation thread until input arrives and then call resume.
+   */
+  bool idle(void) const {
+    return veranke.waiting && veranke.keypad == 0 && veranke.delay_timer == 0 && veranke.sound_timer == 0 && !veranke.changed();
+  }
+
+  /*
+   * Start pacing afresh from now, e.g., after the host parked while idle,
+   * instead of trying to catch up on the frames it slept through.
+   */
+  void resume(void) {
+    deadline = Clock::now();
+  }
+
+  /*
+   * In FIXED mode, sleep until the next frame is due.
+   */
+  void wait(void) const {
+    if (mode == FIXED) {
+      std::this_thread::sleep_until(deadline);
+    }
+  }
+
+  Veranke &veranke;
+
+  Presenter present;
+
+  Feeder feed;
+
+  /*
+   * Called after every frame's instructions, presented or not, before its
+   * timers tick, e.g., to turn the sound timer into the frame's audio.
+   */
+  Presenter listen;
+
+  std::size_t instructions_per_frame;
+
+  Mode mode;
+
+  /*
+   * Frames run, frames presented, and changed frames TURBO mode did not
+   * present.
+   */
+  std::uint64_t frames;
+
+  std::uint64_t presented;
+
+  std::uint64_t skipped;
+
+private:
+  Clock::duration period;
+
+  Clock::time_point deadline;
+
+  Clock::time_point next_present;
+};
+
+#endif
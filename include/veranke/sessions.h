@@ -0,0 +1,428 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_SESSIONS_H
+
+#define VERANKE_SESSIONS_H
+
+/*
+ * Requires C++20 for coroutines; the rest of Veranke builds as C++11.
+ */
+
+#include "veranke.h"
+#include "veranke/input.h"
+#include "veranke/scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+ * One of a SessionHost's threads and the sessions pinned to it.
+ */
+struct SessionWorker {
+  SessionWorker(): stopping(false), busy(0) {
+  }
+
+  struct Timer {
+    Scheduler::Clock::time_point deadline;
+
+    std::coroutine_handle<> coroutine;
+
+    bool operator<(const Timer &other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  std::thread thread;
+
+  std::mutex mutex;
+
+  std::condition_variable wake;
+
+  /*
+   * Coroutines to resume now: new sessions, and parked ones a key press
+   * woke. Guarded by mutex.
+   */
+  std::deque<std::coroutine_handle<> > ready;
+
+  /*
+   * Coroutines waiting for their next frame, soonest first. Only touched
+   * by this worker's thread.
+   */
+  std::priority_queue<Timer> timers;
+
+  bool stopping;
+
+  /*
+   * Clock ticks spent resuming coroutines.
+   */
+  std::atomic<Scheduler::Clock::rep> busy;
+};
+
+/*
+ * One machine hosted by a SessionHost, with its input and timing.
+ */
+class Session {
+public:
+  typedef Scheduler::Clock Clock;
+
+  Session(Veranke::Core core, std::uint64_t seed, std::size_t instructions_per_frame): veranke(core, seed), scheduler(veranke, Scheduler::Presenter(), instructions_per_frame), ticks(0), total_lag(0), maximum_lag(0), parked(), worker(0) {
+  }
+
+  /*
+   * Press or release one of the machine's keys, from any thread. A session
+   * parked waiting for a key is woken.
+   */
+  void press(std::uint8_t key);
+
+  void release(std::uint8_t key) {
+    input.release(key);
+  }
+
+  /*
+   * How late, on average and at worst, the session's frames started
+   * after they were due.
+   */
+  Clock::duration mean_lag(void) const {
+    return ticks > 0 ? total_lag / (Clock::rep) ticks : Clock::duration::zero();
+  }
+
+  Veranke veranke;
+
+  Scheduler scheduler;
+
+  Input input;
+
+  /*
+   * Frames run, and the lag they started with.
+   */
+  std::uint64_t ticks;
+
+  Clock::duration total_lag;
+
+  Clock::duration maximum_lag;
+
+private:
+  friend class SessionHost;
+
+  Clock::time_point deadline;
+
+  /*
+   * The coroutine, while it is parked waiting for a key.
+   */
+  std::coroutine_handle<> parked;
+
+  SessionWorker * worker;
+};
+
+/*
+ * Runs thousands of sessions on a small, fixed set of threads. Each
+ * session is a coroutine pinned to one thread. It suspends until its next
+ * 60 Hz frame is due, or, while its machine is halted waiting for a key,
+ * until a key is pressed. A thread therefore only spends time on sessions
+ * that have work, and a parked session costs nothing but its memory.
+ */
+class SessionHost {
+public:
+  typedef Session::Clock Clock;
+
+  explicit SessionHost(std::size_t threads = std::thread::hardware_concurrency()): next(0), started(Clock::now()) {
+    if (threads == 0) {
+      threads = 1;
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+      workers.push_back(std::unique_ptr<SessionWorker>(new SessionWorker));
+    }
+
+    for (std::size_t i = 0; i < threads; ++i) {
+      workers[i]->thread = std::thread(&SessionHost::work, this, std::ref(*workers[i]));
+    }
+  }
+
+  ~SessionHost() {
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      SessionWorker &worker = *workers[i];
+
+      {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        worker.stopping = true;
+      }
+
+      worker.wake.notify_one();
+
+      worker.thread.join();
+    }
+
+    for (std::size_t i = 0; i < coroutines.size(); ++i) {
+      coroutines[i].destroy();
+    }
+  }
+
+  /*
+   * Start a session running rom. Returns it, or null if the ROM does not
+   * fit. Sessions live as long as the host.
+   */
+  Session * spawn(const std::uint8_t * rom, std::size_t size, Veranke::Core core = Veranke::PREDECODED, std::uint64_t seed = 0, std::size_t instructions_per_frame = Scheduler::DEFAULT_INSTRUCTIONS_PER_FRAME) {
+    std::unique_ptr<Session> session(new Session(core, seed, instructions_per_frame));
+
+    if (!session->veranke.load(rom, size)) {
+      return 0;
+    }
+
+    SessionWorker &worker = *workers[next++ % workers.size()];
+
+    session->worker = &worker;
+
+    session->deadline = Clock::now();
+
+    std::coroutine_handle<> coroutine = live(*session).handle;
+
+    coroutines.push_back(coroutine);
+
+    sessions.push_back(std::move(session));
+
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+
+      worker.ready.push_back(coroutine);
+    }
+
+    worker.wake.notify_one();
+
+    return sessions.back().get();
+  }
+
+  std::size_t size(void) const {
+    return sessions.size();
+  }
+
+  Session & session(std::size_t i) {
+    return *sessions[i];
+  }
+
+  std::size_t threads(void) const {
+    return workers.size();
+  }
+
+  /*
+   * How many sessions one fully busy core could host at the current load:
+   * the sessions, divided by the cores' worth of time spent running them.
+   */
+  double machines_per_core(void) const {
+    double busy = 0;
+
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      busy += std::chrono::duration<double>(Clock::duration(workers[i]->busy.load(std::memory_order_relaxed))).count();
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    return busy > 0 ? sessions.size() * elapsed / busy : 0;
+  }
+
+private:
+  friend class Session;
+
+  /*
+   * The coroutine type of a session. It is started by its worker and
+   * destroyed by the host; it never finishes on its own.
+   */
+  struct Coroutine {
+    struct promise_type {
+      Coroutine get_return_object(void) {
+        return Coroutine{std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+
+      std::suspend_always initial_suspend(void) {
+        return std::suspend_always();
+      }
+
+      std::suspend_always final_suspend(void) noexcept {
+        return std::suspend_always();
+      }
+
+      void return_void(void) {
+      }
+
+      void unhandled_exception(void) {
+        std::terminate();
+      }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  /*
+   * Suspends a session until its next frame is due, and records how late
+   * it was resumed.
+   */
+  struct Tick {
+    Session &session;
+
+    bool await_ready(void) const {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> coroutine) {
+      SessionWorker::Timer timer = {session.deadline, coroutine};
+
+      session.worker->timers.push(timer);
+    }
+
+    void await_resume(void) {
+      Clock::duration lag = Clock::now() - session.deadline;
+
+      ++session.ticks;
+
+      session.total_lag += lag;
+
+      session.maximum_lag = std::max(session.maximum_lag, lag);
+    }
+  };
+
+  /*
+   * Suspends a session until a key is pressed.
+   */
+  struct Keypress {
+    Session &session;
+
+    bool await_ready(void) const {
+      return session.input.state() != 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine) {
+      std::lock_guard<std::mutex> lock(session.worker->mutex);
+
+      /*
+       * Checked again under the lock press takes, so a key pressed just
+       * now is not missed.
+       */
+      if (session.input.state() != 0) {
+        return false;
+      }
+
+      session.parked = coroutine;
+
+      return true;
+    }
+
+    void await_resume(void) {
+    }
+  };
+
+  static Coroutine live(Session &session) {
+    for (;;) {
+      if (session.scheduler.idle()) {
+        co_await Keypress{session};
+
+        session.deadline = Clock::now();
+      }
+
+      co_await Tick{session};
+
+      session.veranke.keypad = session.input.state();
+
+      session.scheduler.run_frame();
+
+      session.deadline += period();
+    }
+  }
+
+  static Clock::duration period(void) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / 60));
+  }
+
+  void work(SessionWorker &worker) {
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    while (!worker.stopping) {
+      std::coroutine_handle<> coroutine;
+
+      if (!worker.ready.empty()) {
+        coroutine = worker.ready.front();
+
+        worker.ready.pop_front();
+      } else if (!worker.timers.empty() && worker.timers.top().deadline <= Clock::now()) {
+        coroutine = worker.timers.top().coroutine;
+
+        worker.timers.pop();
+      } else {
+        if (worker.timers.empty()) {
+          worker.wake.wait(lock);
+        } else {
+          worker.wake.wait_until(lock, worker.timers.top().deadline);
+        }
+
+        continue;
+      }
+
+      lock.unlock();
+
+      Clock::time_point start = Clock::now();
+
+      coroutine.resume();
+
+      worker.busy.fetch_add((Clock::now() - start).count(), std::memory_order_relaxed);
+
+      lock.lock();
+    }
+  }
+
+  std::vector<std::unique_ptr<SessionWorker> > workers;
+
+  std::vector<std::unique_ptr<Session> > sessions;
+
+  std::vector<std::coroutine_handle<> > coroutines;
+
+  std::size_t next;
+
+  Clock::time_point started;
+};
+
+inline void Session::press(std::uint8_t key) {
+  input.press(key);
+
+  std::lock_guard<std::mutex> lock(worker->mutex);
+
+  if (parked) {
+    worker->ready.push_back(parked);
+
+    parked = std::coroutine_handle<>();
+
+    worker->wake.notify_one();
+  }
+}
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_SHARED_H
+
+#define VERANKE_SHARED_H
+
+#include "veranke.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A machine's display and timers exported through a POSIX shared-memory
+ * segment, and a ring of key events coming back, so that other local
+ * processes (e.g., recorders, agents, or dashboards) can watch and play
+ * without sockets or copies through the kernel.
+ *
+ * The emulator creates the segment and publishes every changed frame
+ * under a sequence lock: the sequence is odd while a frame is being
+ * written, so a reader that sees the same even sequence before and after
+ * copying knows its copy is whole. Readers attach to the segment and push
+ * key presses and releases onto a single-producer, single-consumer ring
+ * that the emulator drains once per frame.
+ */
+class SharedSegment {
+public:
+  static const std::uint32_t MAGIC = 0x56524B53;
+
+  static const std::uint32_t VERSION = 2;
+
+  static const std::uint32_t EVENTS = 256;
+
+  /*
+   * A whole frame as a reader sees it.
+   */
+  struct Frame : Display {
+    std::uint64_t sequence;
+
+    std::uint64_t frame;
+
+    std::uint8_t delay_timer;
+
+    std::uint8_t sound_timer;
+  };
+
+  SharedSegment(): layout(0), owner(false) {
+  }
+
+  ~SharedSegment() {
+    close();
+  }
+
+  /*
+   * Create the segment called name (e.g., "/veranke"), replacing any left
+   * by an earlier run. Returns false if shared memory is unavailable.
+   */
+  bool create(const char * name) {
+    close();
+
+    shm_unlink(name);
+
+    int descriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (descriptor < 0) {
+      return false;
+    }
+
+    if (ftruncate(descriptor, sizeof(Layout)) != 0 || !map(descriptor)) {
+      ::close(descriptor);
+
+      shm_unlink(name);
+
+      return false;
+    }
+
+    ::close(descriptor);
+
+    new (layout) Layout();
+
+    std::strncpy(path, name, sizeof(path) - 1);
+
+    path[sizeof(path) - 1] = 0;
+
+    owner = true;
+
+    layout->magic.store(MAGIC, std::memory_order_release);
+
+    return true;
+  }
+
+  /*
+   * Attach to a segment another process created. Returns false if there
+   * is none, or it is not a Veranke segment of this version.
+   */
+  bool attach(const char * name) {
+    close();
+
+    int descriptor = shm_open(name, O_RDWR, 0);
+
+    if (descriptor < 0) {
+      return false;
+    }
+
+    struct stat status;
+
+    bool mapped = fstat(descriptor, &status) == 0 && (std::size_t) status.st_size >= sizeof(Layout) && map(descriptor);
+
+    ::close(descriptor);
+
+    if (!mapped || layout->magic.load(std::memory_order_acquire) != MAGIC || layout->version != VERSION) {
+      close();
+
+      return false;
+    }
+
+    return true;
+  }
+
+  void close(void) {
+    if (layout) {
+      munmap(layout, sizeof(Layout));
+
+      layout = 0;
+    }
+
+    if (owner) {
+      shm_unlink(path);
+
+      owner = false;
+    }
+  }
+
+  /*
+   * Emulator side: publish the machine's display and timers as the next
+   * frame.
+   */
+  void publish(const Veranke &veranke) {
+    std::uint64_t sequence = layout->sequence.load(std::memory_order_relaxed);
+
+    layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const std::uint64_t * words = &veranke.video_memory[0][0][0];
+
+    for (std::size_t i = 0; i < WORDS; ++i) {
+      layout->video_memory[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    layout->hires.store(veranke.hires, std::memory_order_relaxed);
+
+    layout->delay_timer.store(veranke.delay_timer, std::memory_order_relaxed);
+
+    layout->sound_timer.store(veranke.sound_timer, std::memory_order_relaxed);
+
+    layout->frame.store(layout->frame.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    layout->sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  /*
+   * Reader side: copy the latest frame. Returns false, leaving frame
+   * untouched, if it has not changed since sequence or if the emulator is
+   * writing it right now; the reader never waits on the emulator.
+   */
+  bool read(Frame &frame, std::uint64_t sequence = 0) const {
+    for (;;) {
+      std::uint64_t before = layout->sequence.load(std::memory_order_acquire);
+
+      if (before == sequence || (before & 1)) {
+        return false;
+      }
+
+      std::uint64_t * words = &frame.video_memory[0][0][0];
+
+      for (std::size_t i = 0; i < WORDS; ++i) {
+        words[i] = layout->video_memory[i].load(std::memory_order_relaxed);
+      }
+
+      frame.hires = layout->hires.load(std::memory_order_relaxed);
+
+      frame.delay_timer = layout->delay_timer.load(std::memory_order_relaxed);
+
+      frame.sound_timer = layout->sound_timer.load(std::memory_order_relaxed);
+
+      frame.frame = layout->frame.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      if (layout->sequence.load(std::memory_order_relaxed) == before) {
+        frame.sequence = before;
+
+        return true;
+      }
+    }
+  }
+
+  /*
+   * Reader side: queue a key press or release. Returns false if the ring
+   * is full. Only one process may push.
+   */
+  bool push(std::uint8_t key, bool down) {
+    std::uint32_t head = layout->head.load(std::memory_order_relaxed);
+
+    if (head - layout->tail.load(std::memory_order_acquire) == EVENTS) {
+      return false;
+    }
+
+    layout->events[head % EVENTS] = (std::uint8_t) ((key & 0xF) | (down ? 0x80 : 0));
+
+    layout->head.store(head + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /*
+   * Emulator side: take the oldest queued key event. Returns false if
+   * there is none.
+   */
+  bool pop(std::uint8_t &key, bool &down) {
+    std::uint32_t tail = layout->tail.load(std::memory_order_relaxed);
+
+    if (tail == layout->head.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    std::uint8_t event = layout->events[tail % EVENTS];
+
+    layout->tail.store(tail + 1, std::memory_order_release);
+
+    key = event & 0xF;
+
+    down = (event & 0x80) != 0;
+
+    return true;
+  }
+
+  bool is_open(void) const {
+    return layout != 0;
+  }
+
+private:
+  static const std::size_t WORDS = Display::PLANES * 64 * 2;
+
+  /*
+   * The segment's contents. Every field is a lock-free atomic or written
+   * before the segment is published, so it is safe to share between
+   * processes. The sequence and the input ring each sit on their own
+   * cache line.
+   */
+  struct Layout {
+    Layout(): magic(0), version(VERSION), sequence(0), frame(0), hires(false), delay_timer(0), sound_timer(0), head(0), tail(0) {
+      for (std::size_t i = 0; i < WORDS; ++i) {
+        video_memory[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    std::atomic<std::uint32_t> magic;
+
+    std::uint32_t version;
+
+    alignas(64) std::atomic<std::uint64_t> sequence;
+
+    std::atomic<std::uint64_t> frame;
+
+    /*
+     * Display::video_memory, word for word.
+     */
+    std::atomic<std::uint64_t> video_memory[WORDS];
+
+    std::atomic<bool> hires;
+
+    std::atomic<std::uint8_t> delay_timer;
+
+    std::atomic<std::uint8_t> sound_timer;
+
+    alignas(64) std::atomic<std::uint32_t> head;
+
+    alignas(64) std::atomic<std::uint32_t> tail;
+
+    std::uint8_t events[EVENTS];
+  };
+
+  bool map(int descriptor) {
+    void * address = mmap(0, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+
+    if (address == MAP_FAILED) {
+      return false;
+    }
+
+    layout = (Layout *) address;
+
+    return true;
+  }
+
+  Layout * layout;
+
+  bool owner;
+
+  char path[256];
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VERANKE_TRIPLE_BUFFER_H
+
+#define VERANKE_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/*
+ * A lock-free triple buffer for handing values (e.g., finished frames) from
+ * one producer thread to one consumer thread.
+ *
+ * The producer fills back() and publishes it; the consumer picks up the
+ * most recently published value with update() and reads it through
+ * front(). Neither side ever waits for the other: the producer always has
+ * a buffer of its own to write, and values the consumer is too slow to
+ * see are simply replaced.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+  TripleBuffer(): back_index(0), middle(1), front_index(2) {
+  }
+
+  /*
+   * The producer's buffer.
+   */
+  T & back(void) {
+    return buffers[back_index];
+  }
+
+  /*
+   * Make the producer's buffer the latest value and take the spare one to
+   * write next.
+   */
+  void publish(void) {
+    back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  /*
+   * Move the latest published value to the front. Returns false, leaving
+   * the front as it was, if nothing has been published since the last
+   * update.
+   */
+  bool update(void) {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+      return false;
+    }
+
+    front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+
+    return true;
+  }
+
+  /*
+   * The consumer's buffer.
+   */
+  const T & front(void) const {
+    return buffers[front_index];
+  }
+
+private:
+  static const unsigned INDEX = 0x3;
+
+  static const unsigned FRESH = 0x4;
+
+  T buffers[3];
+
+  /*
+   * Each index is kept on its own cache line so that the producer and the
+   * consumer do not contend for one.
+   */
+  alignas(64) unsigned back_index;
+
+  alignas(64) std::atomic<unsigned> middle;
+
+  alignas(64) unsigned front_index;
+};
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "veranke.h"
+#include "veranke/audio.h"
+#include "veranke/movie.h"
+#include "veranke/pool.h"
+#include "veranke/scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+ * A ROM to run, optionally driven by a movie recorded on it, and
+ * optionally a WAV file to write its audio to and a path to write its
+ * profile report to.
+ */
+struct Job {
+  std::string rom;
+
+  std::string movie;
+
+  std::string wav;
+
+  std::string report;
+};
+
+struct Result {
+  Result(): ok(false), display(0), instructions(0), frames(0), seconds(0) {
+  }
+
+  bool ok;
+
+  std::string error;
+
+  std::uint64_t display;
+
+  std::uint64_t instructions;
+
+  std::uint64_t frames;
+
+  double seconds;
+};
+
+/*
+ * Settings shared by every job. A zero budget is no limit; a job with
+ * neither a movie nor a frame budget runs DEFAULT_FRAMES.
+ */
+struct Settings {
+  Settings(): core(Veranke::JIT), profile(Veranke::MODERN), seed(0), speed(Scheduler::DEFAULT_INSTRUCTIONS_PER_FRAME), instructions(0), frames(0), threads(0) {
+  }
+
+  Veranke::Core core;
+
+  Veranke::Profile profile;
+
+  std::uint64_t seed;
+
+  std::size_t speed;
+
+  std::uint64_t instructions;
+
+  std::uint64_t frames;
+
+  std::size_t threads;
+
+  /*
+   * With --wav, the directory each job's audio is written to, as the
+   * job's index on the command line or stdin, e.g., 0.wav.
+   */
+  std::string wav;
+
+  /*
+   * With --profile, in profiling builds, the directory each job's
+   * hot-spot report and folded call stacks are written to, e.g., 0.txt
+   * and 0.folded.
+   */
+  std::string reports;
+};
+
+static const std::uint64_t DEFAULT_FRAMES = 3600;
+
+static bool read(const std::string &path, std::vector<char> &bytes) {
+  std::ifstream file;
+
+  file.open(path.c_str(), std::ios_base::in | std::ios_base::binary);
+
+  if (!file.is_open()) {
+    return false;
+  }
+
+  bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+  return true;
+}
+
+/*
+ * Write profiler's report to path.txt and its call stacks to path.folded.
+ */
+static bool write(const Profiler &profiler, const std::string &path) {
+  std::FILE * report = std::fopen((path + ".txt").c_str(), "w");
+
+  if (!report) {
+    return false;
+  }
+
+  profiler.report(report);
+
+  std::FILE * stacks = std::fopen((path + ".folded").c_str(), "w");
+
+  if (!stacks) {
+    std::fclose(report);
+
+    return false;
+  }
+
+  profiler.collapse(stacks);
+
+  bool ok = !std::ferror(report) && !std::ferror(stacks);
+
+  return (std::fclose(report) == 0) & (std::fclose(stacks) == 0) && ok;
+}
+
+/*
+ * Run one job headless, one 60 Hz frame at a time, until its movie, its
+ * frame budget, or its instruction budget runs out, or it halts waiting
+ * for a key no input is left to press.
+ */
+static void run(const Job &job, const Settings &settings, Result &result) {
+  std::vector<char> rom;
+
+  if (!read(job.rom, rom)) {
+    result.error = "cannot load ROM";
+
+    return;
+  }
+
+  Movie movie;
+
+  movie.seed = settings.seed;
+
+  movie.instructions_per_frame = (std::uint32_t) settings.speed;
+
+  movie.profile = settings.profile;
+
+  if (!job.movie.empty()) {
+    std::ifstream file(job.movie.c_str(), std::ios_base::in | std::ios_base::binary);
+
+    if (!movie.read(file)) {
+      result.error = "cannot read movie";
+
+      return;
+    }
+
+    if (movie.rom != Movie::hash((const std::uint8_t *) rom.data(), rom.size())) {
+      result.error = "movie was recorded on a different ROM";
+
+      return;
+    }
+  }
+
+  std::uint64_t frames = settings.frames;
+
+  if (!job.movie.empty() && (frames == 0 || frames > movie.frames.size())) {
+    frames = movie.frames.size();
+  } else if (frames == 0 && settings.instructions == 0) {
+    frames = DEFAULT_FRAMES;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  Veranke veranke(settings.core, movie.seed, movie.profile);
+
+  if (!veranke.load((const std::uint8_t *) rom.data(), rom.size())) {
+    result.error = "ROM does not fit in memory";
+
+    return;
+  }
+
+  Synthesizer synthesizer;
+
+  std::vector<std::int16_t> samples(synthesizer.maximum());
+
+  WavWriter wav;
+
+  if (!job.wav.empty() && !wav.open(job.wav.c_str(), synthesizer.rate)) {
+    result.error = "cannot write " + job.wav;
+
+    return;
+  }
+
+  while (frames == 0 || result.frames < frames) {
+    std::uint64_t budget = movie.instructions_per_frame;
+
+    if (settings.instructions > 0) {
+      if (result.instructions >= settings.instructions) {
+        break;
+      }
+
+      budget = std::min(budget, settings.instructions - result.instructions);
+    }
+
+    /*
+     * A movie recorded at no instructions per frame would never use up an
+     * instruction budget.
+     */
+    if (budget == 0) {
+      break;
+    }
+
+    if (result.frames < movie.frames.size()) {
+      veranke.keypad = movie.frames[result.frames];
+    }
+
+    result.instructions += veranke.run((std::size_t) budget);
+
+    if (veranke.waiting && result.frames >= movie.frames.size()) {
+      break;
+    }
+
+    if (wav.is_open()) {
+      wav.write(samples.data(), synthesizer.render(veranke, samples.data()));
+    }
+
+    veranke.tick();
+
+    ++result.frames;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  result.seconds = elapsed.count();
+
+  result.display = Movie::hash((const std::uint8_t *) veranke.video_memory.data(), sizeof(veranke.video_memory));
+
+  if (!wav.close()) {
+    result.error = "cannot write " + job.wav;
+
+    return;
+  }
+
+  if (!job.report.empty() && !write(veranke.profiler, job.report)) {
+    result.error = "cannot write " + job.report;
+
+    return;
+  }
+
+  result.ok = true;
+}
+
+/*
+ * A job is a ROM path, or a ROM path and a movie path separated by a
+ * comma.
+ */
+static Job parse(const std::string &line) {
+  Job job;
+
+  std::size_t comma = line.find(',');
+
+  job.rom = line.substr(0, comma);
+
+  if (comma != std::string::npos) {
+    job.movie = line.substr(comma + 1);
+  }
+
+  return job;
+}
+
+static int usage(void) {
+  std::fprintf(stderr, "usage: veranke-batch [--core switch|table|predecoded|jit|fused] [--quirks modern|cosmac|schip] [--threads n] [--seed n] [--speed instructions-per-frame] [--instructions n] [--frames n] [--wav directory] [--profile directory] [ROM[,movie] ...]\n");
+
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  Settings settings;
+
+  int i = 1;
+
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i += 2) {
+    if (i + 1 == argc) {
+      return usage();
+    }
+
+    const char * value = argv[i + 1];
+
+    if (std::strcmp(argv[i], "--core") == 0) {
+      if (!Veranke::core_named(value, settings.core)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i], "--quirks") == 0) {
+      if (!Veranke::profile_named(value, settings.profile)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      settings.threads = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--seed") == 0) {
+      settings.seed = (std::uint64_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--speed") == 0) {
+      settings.speed = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--instructions") == 0) {
+      settings.instructions = (std::uint64_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--frames") == 0) {
+      settings.frames = (std::uint64_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--wav") == 0) {
+      settings.wav = value;
+    } else if (std::strcmp(argv[i], "--profile") == 0) {
+      if (!Profiler::ENABLED) {
+        std::fprintf(stderr, "veranke-batch: --profile needs a build with VERANKE_PROFILE\n");
+
+        return 1;
+      }
+
+      settings.reports = value;
+    } else {
+      return usage();
+    }
+  }
+
+  if (settings.speed == 0) {
+    return usage();
+  }
+
+  std::vector<Job> jobs;
+
+  for (; i < argc; ++i) {
+    jobs.push_back(parse(argv[i]));
+  }
+
+  /*
+   * With no jobs on the command line, read one per line from stdin.
+   */
+  if (jobs.empty()) {
+    std::string line;
+
+    while (std::getline(std::cin, line)) {
+      if (!line.empty()) {
+        jobs.push_back(parse(line));
+      }
+    }
+  }
+
+  for (std::size_t j = 0; j < jobs.size(); ++j) {
+    std::string name = std::to_string((unsigned long long) j);
+
+    if (!settings.wav.empty()) {
+      jobs[j].wav = settings.wav + "/" + name + ".wav";
+    }
+
+    if (!settings.reports.empty()) {
+      jobs[j].report = settings.reports + "/" + name;
+    }
+  }
+
+  std::vector<Result> results(jobs.size());
+
+  auto start = std::chrono::steady_clock::now();
+
+  {
+    Pool pool(settings.threads > 0 ? settings.threads : std::thread::hardware_concurrency());
+
+    for (std::size_t j = 0; j < jobs.size(); ++j) {
+      const Job &job = jobs[j];
+
+      Result &result = results[j];
+
+      pool.submit([&job, &settings, &result]() {
+        run(job, settings, result);
+      });
+    }
+
+    pool.wait();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::uint64_t instructions = 0;
+
+  int status = 0;
+
+  std::printf("%-16s %14s %10s %10s  %s\n", "display", "instructions", "frames", "seconds", "job");
+
+  for (std::size_t j = 0; j < jobs.size(); ++j) {
+    const Result &result = results[j];
+
+    std::string name = jobs[j].movie.empty() ? jobs[j].rom : jobs[j].rom + "," + jobs[j].movie;
+
+    if (!result.ok) {
+      std::printf("%-16s %14s %10s %10s  %s: %s\n", "-", "-", "-", "-", name.c_str(), result.error.c_str());
+
+      status = 1;
+
+      continue;
+    }
+
+    std::printf("%016" PRIx64 " %14" PRIu64 " %10" PRIu64 " %10.3f  %s\n", result.display, result.instructions, result.frames, result.seconds, name.c_str());
+
+    instructions += result.instructions;
+  }
+
+  std::fprintf(stderr, "%zu jobs, %" PRIu64 " instructions in %.3f s (%.0f instructions/sec)\n", jobs.size(), instructions, elapsed.count(), instructions / elapsed.count());
+
+  return status;
+}
@@ -0,0 +1,576 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "veranke.h"
+#include "veranke/batch.h"
+#include "veranke/counters.h"
+#include "veranke/movie.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * A ROM to measure: one of the synthetic ROMs below, or one read from
+ * disk.
+ */
+struct Program {
+  std::string name;
+
+  std::vector<std::uint8_t> rom;
+};
+
+/*
+ * Tight loops, each dominated by one family of instructions. None of them
+ * waits for a key or settles into a loop the cores fast-forward, so every
+ * instruction counted is one interpreted.
+ */
+static const std::uint8_t ALU[] = {
+  0x60, 0x01,  // 200  LD V0, 1
+  0x61, 0x03,  // 202  LD V1, 3
+  0x80, 0x14,  // 204  ADD V0, V1
+  0x81, 0x05,  // 206  SUB V1, V0
+  0x82, 0x02,  // 208  AND V2, V0
+  0x83, 0x11,  // 20A  OR V3, V1
+  0x84, 0x13,  // 20C  XOR V4, V1
+  0x85, 0x0E,  // 20E  SHL V5, V0
+  0x86, 0x16,  // 210  SHR V6, V1
+  0x77, 0x05,  // 212  ADD V7, 5
+  0x80, 0x17,  // 214  SUBN V0, V1
+  0x12, 0x04   // 216  JP 204
+};
+
+static const std::uint8_t BRANCH[] = {
+  0x60, 0x00,  // 200  LD V0, 0
+  0x70, 0x01,  // 202  ADD V0, 1
+  0x30, 0x80,  // 204  SE V0, 80
+  0x40, 0x01,  // 206  SNE V0, 1
+  0x61, 0x00,  // 208  LD V1, 0
+  0x50, 0x10,  // 20A  SE V0, V1
+  0x90, 0x10,  // 20C  SNE V0, V1
+  0x71, 0x01,  // 20E  ADD V1, 1
+  0x12, 0x02   // 210  JP 202
+};
+
+static const std::uint8_t DRAW[] = {
+  0x60, 0x00,  // 200  LD V0, 0
+  0x61, 0x00,  // 202  LD V1, 0
+  0x62, 0x00,  // 204  LD V2, 0
+  0xF2, 0x29,  // 206  LD F, V2
+  0xD0, 0x15,  // 208  DRW V0, V1, 5
+  0x70, 0x03,  // 20A  ADD V0, 3
+  0x71, 0x02,  // 20C  ADD V1, 2
+  0x72, 0x01,  // 20E  ADD V2, 1
+  0x12, 0x06   // 210  JP 206
+};
+
+static const std::uint8_t MEMORY[] = {
+  0x6E, 0x00,  // 200  LD VE, 0
+  0xA8, 0x00,  // 202  LD I, 800
+  0xF7, 0x65,  // 204  LD V7, [I]
+  0x70, 0x01,  // 206  ADD V0, 1
+  0xF7, 0x55,  // 208  LD [I], V7
+  0x6D, 0x08,  // 20A  LD VD, 8
+  0xFD, 0x1E,  // 20C  ADD I, VD
+  0x7E, 0x01,  // 20E  ADD VE, 1
+  0x3E, 0x00,  // 210  SE VE, 0
+  0x12, 0x04,  // 212  JP 204
+  0x12, 0x00   // 214  JP 200
+};
+
+static const std::uint8_t CALL[] = {
+  0x22, 0x06,  // 200  CALL 206
+  0x70, 0x01,  // 202  ADD V0, 1
+  0x12, 0x00,  // 204  JP 200
+  0x22, 0x0C,  // 206  CALL 20C
+  0x71, 0x01,  // 208  ADD V1, 1
+  0x00, 0xEE,  // 20A  RET
+  0x22, 0x12,  // 20C  CALL 212
+  0x72, 0x01,  // 20E  ADD V2, 1
+  0x00, 0xEE,  // 210  RET
+  0x73, 0x01,  // 212  ADD V3, 1
+  0x00, 0xEE   // 214  RET
+};
+
+static Program synthetic(const char * name, const std::uint8_t * rom, std::size_t size) {
+  Program program;
+
+  program.name = name;
+
+  program.rom.assign(rom, rom + size);
+
+  return program;
+}
+
+/*
+ * The lanes of the lockstep batch measured alongside the cores.
+ */
+static const std::size_t LANES = 32;
+
+static bool read(const char * path, std::vector<std::uint8_t> &bytes) {
+  std::ifstream file;
+
+  file.open(path, std::ios_base::in | std::ios_base::binary);
+
+  if (!file.is_open()) {
+    return false;
+  }
+
+  bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+  return true;
+}
+
+/*
+ * name as a JSON string's contents.
+ */
+static std::string escape(const std::string &name) {
+  std::string escaped;
+
+  for (std::size_t i = 0; i < name.size(); ++i) {
+    unsigned char byte = (unsigned char) name[i];
+
+    if (byte < 0x20) {
+      char code[7];
+
+      std::snprintf(code, sizeof(code), "\\u%04x", byte);
+
+      escaped += code;
+
+      continue;
+    }
+
+    if (byte == '"' || byte == '\\') {
+      escaped += '\\';
+    }
+
+    escaped += name[i];
+  }
+
+  return escaped;
+}
+
+struct Measurement {
+  Measurement(): instructions(0), frames(0), seconds(0), fast_forwarded(0), state(0) {
+    for (std::size_t i = 0; i < Counters::EVENTS; ++i) {
+      events[i] = 0;
+    }
+  }
+
+  std::uint64_t instructions;
+
+  std::uint64_t frames;
+
+  double seconds;
+
+  std::uint64_t fast_forwarded;
+
+  /*
+   * A hash of the final display, registers, and memory. Every core must
+   * agree on it, and it only changes between builds if behaviour does.
+   */
+  std::uint64_t state;
+
+  /*
+   * The hardware events counted over the run, where available.
+   */
+  std::uint64_t events[Counters::EVENTS];
+};
+
+static std::uint64_t hash(const Veranke &veranke) {
+  std::uint64_t parts[] = {
+    Movie::hash((const std::uint8_t *) veranke.video_memory.data(), sizeof(veranke.video_memory)),
+    Movie::hash(veranke.registers.data(), veranke.registers.size()),
+    Movie::hash(veranke.memory.data(), veranke.memory.size()),
+    veranke.index,
+    veranke.program_counter
+  };
+
+  return Movie::hash((const std::uint8_t *) parts, sizeof(parts));
+}
+
+/*
+ * Run program on core one 60 Hz frame at a time until it has executed
+ * instructions, or halts waiting for a key, with counters counting.
+ */
+static Measurement measure(const Program &program, Veranke::Core core, Veranke::Profile profile, std::size_t speed, std::uint64_t instructions, Counters &counters) {
+  Measurement measurement;
+
+  Veranke veranke(core, 0, profile);
+
+  veranke.load(program.rom.data(), program.rom.size());
+
+  counters.start();
+
+  auto start = std::chrono::steady_clock::now();
+
+  while (measurement.instructions < instructions) {
+    std::uint64_t budget = std::min((std::uint64_t) speed, instructions - measurement.instructions);
+
+    measurement.instructions += veranke.run((std::size_t) budget);
+
+    if (veranke.waiting) {
+      break;
+    }
+
+    veranke.tick();
+
+    ++measurement.frames;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  counters.stop();
+
+  for (std::size_t i = 0; i < Counters::EVENTS; ++i) {
+    measurement.events[i] = counters.value((Counters::Event) i);
+  }
+
+  measurement.seconds = elapsed.count();
+
+  measurement.fast_forwarded = veranke.fast_forwarded;
+
+  measurement.state = hash(veranke);
+
+  return measurement;
+}
+
+/*
+ * Run program in every lane of a lockstep batch on the schedule of the
+ * scalar run reference: the same instructions in each frame, the timers
+ * ticked between frames, and no tick after a frame the run stopped in to
+ * wait for a key. Lanes must stay bit-for-bit equal to the scalar core,
+ * so match is set only if every lane ends in reference's state. The
+ * instructions counted are every lane's.
+ */
+static Measurement measure_batch(const Program &program, Veranke::Profile profile, std::size_t speed, const Measurement &reference, Counters &counters, bool &match) {
+  Measurement measurement;
+
+  std::unique_ptr<VerankeBatch<LANES> > batch(new VerankeBatch<LANES>(profile));
+
+  batch->load(program.rom.data(), program.rom.size());
+
+  std::uint64_t executed = 0;
+
+  counters.start();
+
+  auto start = std::chrono::steady_clock::now();
+
+  while (executed < reference.instructions) {
+    std::uint64_t budget = std::min((std::uint64_t) speed, reference.instructions - executed);
+
+    batch->run((std::size_t) budget);
+
+    executed += budget;
+
+    if (measurement.frames == reference.frames) {
+      break;
+    }
+
+    batch->tick();
+
+    ++measurement.frames;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  counters.stop();
+
+  for (std::size_t i = 0; i < Counters::EVENTS; ++i) {
+    measurement.events[i] = counters.value((Counters::Event) i);
+  }
+
+  measurement.seconds = elapsed.count();
+
+  measurement.instructions = executed * LANES;
+
+  measurement.state = hash(batch->lane(0));
+
+  match = true;
+
+  for (std::size_t lane = 0; lane < LANES; ++lane) {
+    match = match && hash(batch->lane(lane)) == reference.state;
+  }
+
+  return measurement;
+}
+
+/*
+ * Print one measurement of program on core, as a table row or a JSON
+ * object.
+ */
+static void report(const Program &program, const char * core, const Measurement &best, const Counters &counters, bool json, bool &first) {
+  double seconds = best.seconds > 0 ? best.seconds : 1e-9;
+
+  double per_second = best.instructions / seconds;
+
+  double nanoseconds = best.instructions > 0 ? seconds * 1e9 / best.instructions : 0;
+
+  double frames_per_second = best.frames / seconds;
+
+  /*
+   * Each counter per emulated instruction, as JSON and as table columns.
+   */
+  std::string events;
+
+  std::string columns;
+
+  for (std::size_t e = 0; e < Counters::EVENTS; ++e) {
+    const char * name = Counters::event_name((Counters::Event) e);
+
+    char text[64];
+
+    if (!counters.available((Counters::Event) e) || best.instructions == 0) {
+      std::snprintf(text, sizeof(text), "%s\"%s\": null", e == 0 ? "" : ", ", name);
+
+      events += text;
+
+      std::snprintf(text, sizeof(text), " %10s", "-");
+
+      columns += text;
+
+      continue;
+    }
+
+    double per_instruction = (double) best.events[e] / best.instructions;
+
+    std::snprintf(text, sizeof(text), "%s\"%s\": %.4f", e == 0 ? "" : ", ", name, per_instruction);
+
+    events += text;
+
+    std::snprintf(text, sizeof(text), " %10.4f", per_instruction);
+
+    columns += text;
+  }
+
+  if (json) {
+    std::printf("%s    {\"rom\": \"%s\", \"core\": \"%s\", \"instructions\": %" PRIu64 ", \"frames\": %" PRIu64 ", \"fast_forwarded\": %" PRIu64 ", \"state\": \"%016" PRIx64 "\", \"seconds\": %.6f, \"instructions_per_second\": %.0f, \"ns_per_instruction\": %.3f, \"frames_per_second\": %.0f, \"per_instruction\": {%s}}", first ? "" : ",\n", escape(program.name).c_str(), core, best.instructions, best.frames, best.fast_forwarded, best.state, best.seconds, per_second, nanoseconds, frames_per_second, events.c_str());
+  } else {
+    std::printf("%-12s %-10s %14.0f %10.3f %14.0f%s %016" PRIx64 "  %" PRIu64 "\n", program.name.c_str(), core, per_second, nanoseconds, frames_per_second, columns.c_str(), best.state, best.fast_forwarded);
+  }
+
+  first = false;
+}
+
+static int usage(void) {
+  std::fprintf(stderr, "usage: veranke-bench [--core switch|table|predecoded|jit|fused] [--quirks modern|cosmac|schip] [--speed instructions-per-frame] [--instructions n] [--repeat n] [--json] [ROM ...]\n");
+
+  return 1;
+}
+
+/*
+ * Measure every core on the synthetic ROMs and then any ROMs given, and
+ * print each one's throughput, as a table or as JSON, one result per line
+ * and in a fixed order so that runs from two builds diff cleanly. Each
+ * measurement is the fastest of --repeat runs. Unless --core picks one
+ * core, every ROM also runs in a 32-lane lockstep batch on the first
+ * core's schedule. Exits with 1 if the cores, or any lane of the batch,
+ * disagree on a ROM's final state.
+ *
+ * Where the host allows, each run is also measured with hardware counters,
+ * reported per emulated instruction: host cycles, host instructions,
+ * branch misses, and L1d misses. A counter the host does not have is left
+ * out (null in JSON).
+ */
+int main(int argc, char **argv) {
+  static const Veranke::Core cores[] = {Veranke::SWITCH, Veranke::TABLE, Veranke::PREDECODED, Veranke::JIT, Veranke::FUSED};
+
+  Veranke::Profile profile = Veranke::MODERN;
+
+  bool all = true;
+
+  Veranke::Core only = Veranke::SWITCH;
+
+  /*
+   * Enough instructions per frame that the core, not the frame loop,
+   * dominates.
+   */
+  std::size_t speed = 1000;
+
+  std::uint64_t instructions = 10000000;
+
+  std::size_t repeat = 3;
+
+  bool json = false;
+
+  int i = 1;
+
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+
+      continue;
+    }
+
+    if (i + 1 == argc) {
+      return usage();
+    }
+
+    const char * value = argv[++i];
+
+    if (std::strcmp(argv[i - 1], "--core") == 0) {
+      if (!Veranke::core_named(value, only)) {
+        return usage();
+      }
+
+      all = false;
+    } else if (std::strcmp(argv[i - 1], "--quirks") == 0) {
+      if (!Veranke::profile_named(value, profile)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i - 1], "--speed") == 0) {
+      speed = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i - 1], "--instructions") == 0) {
+      instructions = (std::uint64_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i - 1], "--repeat") == 0) {
+      repeat = (std::size_t) std::strtoull(value, NULL, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  if (speed == 0 || repeat == 0) {
+    return usage();
+  }
+
+  std::vector<Program> programs;
+
+  programs.push_back(synthetic("alu", ALU, sizeof(ALU)));
+
+  programs.push_back(synthetic("branch", BRANCH, sizeof(BRANCH)));
+
+  programs.push_back(synthetic("draw", DRAW, sizeof(DRAW)));
+
+  programs.push_back(synthetic("memory", MEMORY, sizeof(MEMORY)));
+
+  programs.push_back(synthetic("call", CALL, sizeof(CALL)));
+
+  for (; i < argc; ++i) {
+    Program program;
+
+    program.name = argv[i];
+
+    if (!read(argv[i], program.rom) || program.rom.size() > 0x10000 - 0x200) {
+      std::fprintf(stderr, "veranke-bench: cannot load %s\n", argv[i]);
+
+      return 1;
+    }
+
+    programs.push_back(program);
+  }
+
+  Counters counters;
+
+  if (!counters.available()) {
+    std::fprintf(stderr, "veranke-bench: hardware counters are unavailable; reporting time only\n");
+  }
+
+  if (json) {
+    std::printf("{\n  \"profile\": \"%s\",\n  \"instructions_per_frame\": %zu,\n  \"instructions\": %" PRIu64 ",\n  \"repeat\": %zu,\n  \"results\": [\n", Veranke::profile_name(profile), speed, instructions, repeat);
+  } else {
+    std::printf("%-12s %-10s %14s %10s %14s %10s %10s %10s %10s %16s  %s\n", "rom", "core", "instructions/s", "ns/instr", "frames/s", "cycles/i", "host-i/i", "br-miss/i", "L1d-miss/i", "state", "fast-forwarded");
+  }
+
+  int status = 0;
+
+  bool first = true;
+
+  for (std::size_t p = 0; p < programs.size(); ++p) {
+    std::uint64_t reference = 0;
+
+    /*
+     * The first core's run, whose frames the batch replays.
+     */
+    Measurement schedule;
+
+    for (std::size_t c = 0; c < sizeof(cores) / sizeof(cores[0]); ++c) {
+      if (!all && cores[c] != only) {
+        continue;
+      }
+
+      Measurement best;
+
+      for (std::size_t r = 0; r < repeat; ++r) {
+        Measurement measurement = measure(programs[p], cores[c], profile, speed, instructions, counters);
+
+        if (r == 0 || measurement.seconds < best.seconds) {
+          best = measurement;
+        }
+      }
+
+      if (reference == 0) {
+        reference = best.state;
+
+        schedule = best;
+      } else if (best.state != reference) {
+        std::fprintf(stderr, "veranke-bench: %s: %s disagrees with %s\n", programs[p].name.c_str(), Veranke::core_name(cores[c]), all ? Veranke::core_name(cores[0]) : "the first core");
+
+        status = 1;
+      }
+
+      report(programs[p], Veranke::core_name(cores[c]), best, counters, json, first);
+    }
+
+    if (!all) {
+      continue;
+    }
+
+    Measurement best;
+
+    bool match = true;
+
+    for (std::size_t r = 0; r < repeat; ++r) {
+      bool lanes = true;
+
+      Measurement measurement = measure_batch(programs[p], profile, speed, schedule, counters, lanes);
+
+      match = match && lanes;
+
+      if (r == 0 || measurement.seconds < best.seconds) {
+        best = measurement;
+      }
+    }
+
+    if (!match) {
+      std::fprintf(stderr, "veranke-bench: %s: batch lanes disagree with %s\n", programs[p].name.c_str(), Veranke::core_name(cores[0]));
+
+      status = 1;
+    }
+
+    report(programs[p], "batch", best, counters, json, first);
+  }
+
+  if (json) {
+    std::printf("\n  ]\n}\n");
+  }
+
+  return status;
+}
@@ -0,0 +1,133 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "libveranke.h"
+
+#include "veranke.h"
+
+#include <cstring>
+#include <new>
+
+struct veranke {
+  veranke(Veranke::Core core, std::uint64_t seed, Veranke::Profile profile): machine(core, seed, profile) {
+  }
+
+  Veranke machine;
+};
+
+veranke * veranke_create(int core, uint64_t seed) {
+  return veranke_create_with_quirks(core, seed, VERANKE_QUIRKS_MODERN);
+}
+
+veranke * veranke_create_with_quirks(int core, uint64_t seed, int profile) {
+  if (core < VERANKE_CORE_SWITCH || core > VERANKE_CORE_FUSED || profile < VERANKE_QUIRKS_MODERN || profile > VERANKE_QUIRKS_SCHIP) {
+    return NULL;
+  }
+
+  return new (std::nothrow) veranke((Veranke::Core) core, seed, (Veranke::Profile) profile);
+}
+
+void veranke_destroy(veranke * machine) {
+  delete machine;
+}
+
+int veranke_load(veranke * machine, const uint8_t * rom, size_t size) {
+  return machine->machine.load(rom, size) ? 1 : 0;
+}
+
+size_t veranke_step_n(veranke * machine, size_t n) {
+  return machine->machine.run(n);
+}
+
+uint64_t veranke_run_frames(veranke * machine, size_t n, size_t instructions_per_frame) {
+  Veranke &veranke = machine->machine;
+
+  uint64_t executed = 0;
+
+  for (size_t frame = 0; frame < n; ++frame) {
+    executed += veranke.run(instructions_per_frame);
+
+    veranke.tick();
+  }
+
+  return executed;
+}
+
+void veranke_run_frames_batch(veranke * const * machines, size_t count, size_t n, size_t instructions_per_frame, const uint16_t * keys, uint64_t * executed) {
+  for (size_t i = 0; i < count; ++i) {
+    Veranke &veranke = machines[i]->machine;
+
+    uint64_t total = 0;
+
+    for (size_t frame = 0; frame < n; ++frame) {
+      if (keys) {
+        veranke.keypad = keys[i * n + frame];
+      }
+
+      total += veranke.run(instructions_per_frame);
+
+      veranke.tick();
+    }
+
+    if (executed) {
+      executed[i] = total;
+    }
+  }
+}
+
+void veranke_set_keys(veranke * machine, uint16_t keys) {
+  machine->machine.keypad = keys;
+}
+
+int veranke_waiting(const veranke * machine) {
+  return machine->machine.waiting ? 1 : 0;
+}
+
+uint8_t veranke_sound_timer(const veranke * machine) {
+  return machine->machine.sound_timer;
+}
+
+const uint64_t * veranke_framebuffer(const veranke * machine) {
+  return &machine->machine.video_memory[0][0][0];
+}
+
+int veranke_hires(const veranke * machine) {
+  return machine->machine.hires ? 1 : 0;
+}
+
+size_t veranke_state_size(void) {
+  return sizeof(MachineState);
+}
+
+void veranke_save(const veranke * machine, void * state) {
+  std::memcpy(state, &machine->machine.state(), sizeof(MachineState));
+}
+
+int veranke_restore(veranke * machine, const void * state) {
+  MachineState copy;
+
+  std::memcpy(&copy, state, sizeof(MachineState));
+
+  return machine->machine.restore(copy) ? 1 : 0;
+}
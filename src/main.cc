@@ -23,21 +23,48 @@
  */
 
 #include "veranke.h"
-
+#include "veranke/audio.h"
+#include "veranke/batch.h"
+#include "veranke/input.h"
+#include "veranke/movie.h"
+#include "veranke/rewind.h"
+#include "veranke/scheduler.h"
+#include "veranke/shared.h"
+#include "veranke/triple_buffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <SDL2/SDL.h>
 
-static const int SCREEN_WIDTH  = 64;
-static const int SCREEN_HEIGHT = 32;
+/*
+ * The texture is always SUPER-CHIP's 128x64; a 64x32 display is drawn
+ * into it at twice the size.
+ */
+static const int SCREEN_WIDTH  = 128;
+static const int SCREEN_HEIGHT = 64;
 
-static const std::uint8_t SCALE = 10;
+static const std::uint8_t SCALE = 5;
 
-static SDL_Window * window;
-
-static SDL_Surface * surface;
+/*
+ * Colours by the planes a pixel is lit in, so a single-plane program is
+ * white on black.
+ */
+static const Uint32 palette[16] = {
+  0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555,
+  0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFF00,
+  0xFF880000, 0xFF008800, 0xFF000088, 0xFF888800,
+  0xFFFF00FF, 0xFF00FFFF, 0xFF880088, 0xFF008888
+};
 
-static SDL_Event event;
+static SDL_Window * window;
 
 static SDL_Renderer * renderer;
 
@@ -60,106 +87,530 @@ static SDL_Keycode keymap[16] = {
   SDLK_v
 };
 
-static int events(Veranke &veranke) {
-  veranke.keypad.fill(0);
+/*
+ * The display as handed from the emulator thread to the presentation
+ * thread.
+ */
+typedef Display Frame;
+
+static TripleBuffer<Frame> frames;
+
+static std::atomic<bool> running(true);
+
+/*
+ * The keys held down, written by the presentation thread as SDL reports
+ * them and read by the emulator thread.
+ */
+static Input input;
+
+/*
+ * Held down (Backspace) to step back through history, one frame per
+ * frame.
+ */
+static std::atomic<bool> rewinding(false);
+
+/*
+ * Rewinding is off while recording or playing a movie, which must see
+ * every frame in order. The emulator thread only parks to wait for the
+ * keyboard when no movie or exported segment can press keys instead.
+ */
+static bool rewindable = true;
+
+static bool parkable = true;
+
+static Rewind history;
+
+/*
+ * With --export, the shared-memory segment other processes watch the
+ * display and press keys through.
+ */
+static SharedSegment segment;
+
+/*
+ * Samples on their way from the emulator thread, which synthesizes each
+ * frame's, to the audio device's callback.
+ */
+static AudioRing audio;
+
+/*
+ * The audio device's callback, on SDL's audio thread. It never waits for
+ * the emulator; an underrun fades out instead.
+ */
+static void fill(void *, Uint8 * stream, int length) {
+  audio.pull((std::int16_t *) stream, (std::size_t) length / sizeof(std::int16_t));
+}
+
+/*
+ * Hand a changed display to the presentation thread.
+ */
+static void publish(const Veranke &veranke) {
+  frames.back() = veranke;
+
+  frames.publish();
+}
+
+/*
+ * The emulator thread. It publishes the display through the scheduler and
+ * never waits on the presentation thread, vsync, or the compositor.
+ */
+static void emulate(Scheduler * scheduler) {
+  Veranke &veranke = scheduler->veranke;
+
+  while (running.load(std::memory_order_relaxed)) {
+    if (rewinding.load(std::memory_order_relaxed)) {
+      MachineState state;
+
+      if (history.rewind(state)) {
+        veranke.restore(state);
+
+        publish(veranke);
+
+        veranke.presented();
+      }
+
+      std::this_thread::sleep_for(std::chrono::microseconds(1000000 / 60));
+
+      scheduler->resume();
+
+      continue;
+    }
+
+    /*
+     * Sessions sitting at a "press any key" screen park here instead of
+     * spinning through frames that change nothing.
+     */
+    if (parkable && scheduler->idle()) {
+      input.wait();
+
+      scheduler->resume();
+
+      continue;
+    }
+
+    if (scheduler->advance() > 0) {
+      history.push(veranke.state());
+    }
+
+    scheduler->wait();
+  }
+}
+
+/*
+ * Upload a frame to the streaming texture and let the renderer scale it to
+ * the window.
+ */
+static void present(SDL_Texture * texture, const Frame &frame) {
+  void * pixels;
+
+  int pitch;
 
-  SDL_PollEvent(&event);
+  if (SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0) {
+    int scale = SCREEN_WIDTH / (int) frame.width();
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      Uint32 * row = (Uint32 *) ((Uint8 *) pixels + y * pitch);
+
+      for (int x = 0; x < SCREEN_WIDTH; x++) {
+        row[x] = palette[frame.pixel(x / scale, y / scale)];
+      }
+    }
+
+    SDL_UnlockTexture(texture);
+  }
+
+  SDL_RenderClear(renderer);
+
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+
+  SDL_RenderPresent(renderer);
+}
+
+/*
+ * Drain every pending SDL event into the input state in one pass.
+ */
+static void events(void) {
+  SDL_Event event;
 
-  switch (event.type) {
-    case SDL_KEYDOWN:
-      for (std::size_t i = 0; i < 16; i++) {
-        if (keymap[i] == event.key.keysym.sym) {
-          veranke.keypad[i] = 1;
+  while (SDL_PollEvent(&event)) {
+    switch (event.type) {
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+        if (event.key.keysym.sym == SDLK_BACKSPACE && rewindable) {
+          rewinding.store(event.type == SDL_KEYDOWN, std::memory_order_relaxed);
+
+          input.wake();
 
           break;
         }
-      }
 
-      return 1;
+        for (std::size_t i = 0; i < 16; i++) {
+          if (keymap[i] == event.key.keysym.sym) {
+            if (event.type == SDL_KEYDOWN) {
+              input.press((std::uint8_t) i);
+            } else {
+              input.release((std::uint8_t) i);
+            }
+
+            break;
+          }
+        }
+
+        break;
+
+      case SDL_QUIT:
+        running.store(false, std::memory_order_relaxed);
+
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+static bool read(const char * path, std::vector<char> &rom) {
+  std::ifstream file;
+
+  file.open(path, std::ios_base::in | std::ios_base::binary);
+
+  if (!file.is_open()) {
+    return false;
+  }
+
+  rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+  return true;
+}
+
+static bool load(const char * path, Veranke &veranke) {
+  std::vector<char> rom;
+
+  return read(path, rom) && veranke.load((const std::uint8_t *) rom.data(), rom.size());
+}
+
+static bool same(const Veranke &a, const Veranke &b) {
+  return a.memory == b.memory && a.video_memory == b.video_memory && a.registers == b.registers && a.stack == b.stack && a.index == b.index && a.program_counter == b.program_counter && a.stack_pointer == b.stack_pointer && a.random_state == b.random_state;
+}
 
-    case SDL_QUIT:
-      return 0;
+/*
+ * Run the ROM headless for n instructions on every interpreter core, and
+ * in every lane of a lockstep batch, and report their throughput side by
+ * side. Each core starts from the same state and RNG seed, so their final
+ * states must be identical.
+ */
+static int benchmark(const char * path, std::size_t n, Veranke::Profile profile) {
+  static const Veranke::Core cores[] = {Veranke::SWITCH, Veranke::TABLE, Veranke::PREDECODED, Veranke::JIT, Veranke::FUSED};
+
+  Veranke reference;
+
+  bool match = true;
+
+  for (std::size_t i = 0; i < sizeof(cores) / sizeof(cores[0]); ++i) {
+    Veranke veranke(cores[i], 0, profile);
+
+    if (!load(path, veranke)) {
+      std::fprintf(stderr, "veranke: cannot load %s\n", path);
 
-    default:
       return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    veranke.run(n);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%-10s %14.0f instructions/sec\n", Veranke::core_name(cores[i]), n / elapsed.count());
+
+    if (veranke.fast_forwarded > 0) {
+      std::printf("  %12llu  fast-forwarded in idle loops\n", (unsigned long long) veranke.fast_forwarded);
+    }
+
+    if (cores[i] == Veranke::FUSED) {
+      for (std::size_t j = 0; j < Veranke::FUSIONS; ++j) {
+        if (veranke.fusions[j] > 0) {
+          std::printf("  %12llu  %s\n", (unsigned long long) veranke.fusions[j], Veranke::fusion_name((Veranke::Fusion) j));
+        }
+      }
+    }
+
+    if (i == 0) {
+      reference = veranke;
+    } else {
+      match = match && same(veranke, reference);
+    }
   }
+
+  static const std::size_t LANES = 32;
+
+  std::unique_ptr<VerankeBatch<LANES> > batch(new VerankeBatch<LANES>(profile));
+
+  std::vector<char> rom;
+
+  read(path, rom);
+
+  batch->load((const std::uint8_t *) rom.data(), rom.size());
+
+  auto start = std::chrono::steady_clock::now();
+
+  batch->run(n);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::printf("%-10s %14.0f instructions/sec (%zu lanes, %.1f%% vector steps)\n", "batch", n * LANES / elapsed.count(), LANES, 100.0 * batch->vector_steps / n);
+
+  for (std::size_t lane = 0; lane < LANES; ++lane) {
+    match = match && same(batch->lane(lane), reference);
+  }
+
+  std::printf("results %s\n", match ? "match" : "differ");
+
+  return match ? 0 : 1;
+}
+
+static int usage(void) {
+  std::fprintf(stderr, "usage: veranke [--core switch|table|predecoded|jit|fused] [--quirks modern|cosmac|schip] [--speed instructions-per-frame] [--turbo] [--seed n] [--record movie | --play movie] [--export name] [--benchmark instructions] ROM\n");
+
+  return 1;
 }
 
 int main(int argc, char **argv) {
-  if (argc > 1) {
-    Veranke veranke;
+  Veranke::Core core = Veranke::SWITCH;
 
-    std::ifstream file;
+  Veranke::Profile profile = Veranke::MODERN;
 
-    std::size_t size;
+  std::size_t instructions = 0;
 
-    file.open(argv[1], std::ios_base::in | std::ios_base::binary);
+  std::size_t speed = Scheduler::DEFAULT_INSTRUCTIONS_PER_FRAME;
 
-    if (file.is_open()) {
-      file.seekg(0, std::ios_base::end);
+  Scheduler::Mode mode = Scheduler::FIXED;
 
-      size = (std::size_t) file.tellg();
+  std::uint64_t seed = (std::uint64_t) std::chrono::steady_clock::now().time_since_epoch().count();
 
-      if (size <= 0xFFF - 0x200) {
-        char * ROM = (char *) (&(veranke.memory[0x200]));
+  const char * record = NULL;
 
-        file.seekg(0, std::ios_base::beg);
+  const char * play = NULL;
 
-        file.read(ROM, size);
-      }
+  const char * name = NULL;
 
-      file.close();
+  int i = 1;
+
+  for (; i < argc - 1 && argv[i][0] == '-'; ++i) {
+    if (std::strcmp(argv[i], "--turbo") == 0) {
+      mode = Scheduler::TURBO;
+
+      continue;
     }
 
-    SDL_Init(SDL_INIT_VIDEO);
+    if (i + 1 == argc - 1) {
+      return usage();
+    }
 
-    surface = SDL_CreateRGBSurface(0, 10, 10, 32, 0, 0, 0, 0);
+    const char * value = argv[++i];
 
-    SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 255, 255, 255));
+    if (std::strcmp(argv[i - 1], "--core") == 0) {
+      if (!Veranke::core_named(value, core)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i - 1], "--quirks") == 0) {
+      if (!Veranke::profile_named(value, profile)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i - 1], "--seed") == 0) {
+      seed = (std::uint64_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i - 1], "--speed") == 0) {
+      speed = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i - 1], "--record") == 0) {
+      record = value;
+    } else if (std::strcmp(argv[i - 1], "--play") == 0) {
+      play = value;
+    } else if (std::strcmp(argv[i - 1], "--export") == 0) {
+      name = value;
+    } else if (std::strcmp(argv[i - 1], "--benchmark") == 0) {
+      instructions = (std::size_t) std::strtoull(value, NULL, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  if (i == argc - 1) {
+    if (instructions > 0) {
+      return benchmark(argv[i], instructions, profile);
+    }
 
-    window = SDL_CreateWindow("…", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 320, SDL_WINDOW_RESIZABLE);
+    std::vector<char> rom;
 
-    SDL_Surface * screen = SDL_GetWindowSurface(window);
+    if (!read(argv[i], rom)) {
+      std::fprintf(stderr, "veranke: cannot load %s\n", argv[i]);
 
-    renderer = SDL_CreateRenderer(window, -1, 0);
+      return 1;
+    }
+
+    Movie movie;
 
-    auto events_result = events(veranke);
+    if (play) {
+      std::ifstream file(play, std::ios_base::in | std::ios_base::binary);
 
-    while (events_result) {
-      veranke.decode_and_execute();
+      if (!movie.read(file)) {
+        std::fprintf(stderr, "veranke: cannot read movie %s\n", play);
 
-      if (veranke.delay_timer > 0) {
-        --veranke.delay_timer;
+        return 1;
       }
 
-      if (veranke.sound_timer > 0) {
-        // TODO: implement beep
-        --veranke.sound_timer;
+      if (movie.rom != Movie::hash((const std::uint8_t *) rom.data(), rom.size())) {
+        std::fprintf(stderr, "veranke: %s was recorded on a different ROM\n", play);
+
+        return 1;
       }
 
-      SDL_FillRect(screen, NULL, SDL_MapRGB(screen-> format, 0, 0, 0));
+      seed = movie.seed;
+
+      speed = movie.instructions_per_frame;
+
+      profile = movie.profile;
+    } else {
+      movie.rom = Movie::hash((const std::uint8_t *) rom.data(), rom.size());
 
-      SDL_Rect position;
+      movie.seed = seed;
 
-      for (size_t x = 0; x < SCREEN_WIDTH; x++) {
-        for (size_t y = 0; y < SCREEN_HEIGHT; y++) {
-          position.x = (int) (x * SCALE);
-          position.y = (int) (y * SCALE);
-          position.w = SCALE;
-          position.h = SCALE;
+      movie.instructions_per_frame = (std::uint32_t) speed;
 
-          if (veranke.video_memory[y * 64 + x] == 1) {
-            SDL_FillRect(screen, &position, SDL_MapRGB(screen->format, 255, 255, 255));
+      movie.profile = profile;
+    }
+
+    rewindable = record == NULL && play == NULL;
+
+    parkable = play == NULL && name == NULL;
+
+    Veranke veranke(core, seed, profile);
+
+    veranke.load((const std::uint8_t *) rom.data(), rom.size());
+
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+
+    window = SDL_CreateWindow("…", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE, SDL_WINDOW_RESIZABLE);
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+    SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    SDL_Texture * texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    present(texture, frames.front());
+
+    Scheduler scheduler(veranke, publish, speed, mode);
+
+    /*
+     * A small device buffer keeps latency down; the ring absorbs the
+     * emulator's jitter. Without a device the emulator runs silent.
+     */
+    Synthesizer synthesizer;
+
+    std::vector<std::int16_t> samples(synthesizer.maximum());
+
+    SDL_AudioSpec desired;
+
+    std::memset(&desired, 0, sizeof(desired));
+
+    desired.freq = (int) synthesizer.rate;
+
+    desired.format = AUDIO_S16SYS;
+
+    desired.channels = 1;
+
+    desired.samples = 512;
+
+    desired.callback = fill;
+
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &desired, NULL, 0);
+
+    if (device != 0) {
+      scheduler.listen = [&](const Veranke &machine) {
+        audio.push(samples.data(), synthesizer.render(machine, samples.data()));
+      };
+
+      SDL_PauseAudioDevice(device, 0);
+    } else {
+      std::fprintf(stderr, "veranke: no audio: %s\n", SDL_GetError());
+    }
+
+    std::size_t played = 0;
+
+    /*
+     * Play the movie's keypad until it runs out, then take over from the
+     * keyboard. Recording captures every frame's keypad as it is fed.
+     */
+    if (name && !segment.create(name)) {
+      std::fprintf(stderr, "veranke: cannot export %s\n", name);
+
+      return 1;
+    }
+
+    scheduler.feed = [&](Veranke &machine) {
+      if (segment.is_open()) {
+        std::uint8_t key;
+
+        bool down;
+
+        while (segment.pop(key, down)) {
+          if (down) {
+            input.press(key);
           } else {
-            SDL_FillRect(screen, &position, SDL_MapRGB(screen->format, 0, 0, 0));
+            input.release(key);
           }
         }
+
+        segment.publish(machine);
+      }
+
+      if (play && played < movie.frames.size()) {
+        machine.keypad = movie.frames[played++];
+      } else {
+        machine.keypad = input.state();
       }
 
-      SDL_UpdateWindowSurface(window);
+      if (record && movie.frames.size() < Movie::MAX_FRAMES) {
+        movie.frames.push_back(machine.keypad);
+      }
+    };
+
+    std::thread emulator(emulate, &scheduler);
+
+    /*
+     * This thread owns the window, so it handles events and presentation;
+     * only it ever blocks on vsync.
+     */
+    while (running.load(std::memory_order_relaxed)) {
+      events();
+
+      if (frames.update()) {
+        present(texture, frames.front());
+      } else {
+        SDL_Delay(1);
+      }
+    }
+
+    input.wake();
+
+    emulator.join();
+
+    if (device != 0) {
+      SDL_CloseAudioDevice(device);
     }
 
-    SDL_FreeSurface(surface);
+    if (record) {
+      std::ofstream file(record, std::ios_base::out | std::ios_base::binary);
+
+      if (!movie.write(file)) {
+        std::fprintf(stderr, "veranke: cannot write movie %s\n", record);
+      }
+    }
+
+    SDL_DestroyTexture(texture);
+
+    SDL_DestroyRenderer(renderer);
+
+    SDL_DestroyWindow(window);
 
     SDL_Quit();
   }
@@ -0,0 +1,214 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "veranke.h"
+#include "veranke/shared.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+static void print(const SharedSegment::Frame &frame) {
+  std::printf("frame %llu, delay %u, sound %u\n", (unsigned long long) frame.frame, frame.delay_timer, frame.sound_timer);
+
+  for (std::size_t y = 0; y < frame.height(); ++y) {
+    char row[129];
+
+    for (std::size_t x = 0; x < frame.width(); ++x) {
+      row[x] = " #+*%@=-:~^&$!?o"[frame.pixel(x, y)];
+    }
+
+    row[frame.width()] = 0;
+
+    std::printf("|%s|\n", row);
+  }
+
+  std::fflush(stdout);
+}
+
+/*
+ * Push frames through a fresh segment, publishing through one mapping and
+ * reading through a second, as a separate process would. First one thread
+ * alternates publishing and reading, which times the round trip; then a
+ * producer thread publishes flat out while this one reads concurrently.
+ */
+static int benchmark(double seconds) {
+  std::string name = "/veranke-benchmark-" + std::to_string((long long) getpid());
+
+  SharedSegment writer;
+
+  SharedSegment reader;
+
+  if (!writer.create(name.c_str()) || !reader.attach(name.c_str())) {
+    std::fprintf(stderr, "veranke-reader: shared memory is unavailable\n");
+
+    return 1;
+  }
+
+  Veranke veranke;
+
+  SharedSegment::Frame frame;
+
+  std::uint64_t sequence = 0;
+
+  std::uint64_t published = 0;
+
+  std::uint64_t seen = 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds / 2));
+
+  while (std::chrono::steady_clock::now() < end) {
+    for (int i = 0; i < 1000; ++i) {
+      veranke.video_memory[0][published % 64][0] = published;
+
+      writer.publish(veranke);
+
+      ++published;
+
+      if (reader.read(frame, sequence)) {
+        sequence = frame.sequence;
+
+        ++seen;
+      }
+    }
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::printf("round trip  %14.0f frames/sec\n", seen / elapsed.count());
+
+  std::atomic<bool> running(true);
+
+  published = 0;
+
+  seen = 0;
+
+  std::thread producer([&]() {
+    Veranke machine;
+
+    while (running.load(std::memory_order_relaxed)) {
+      machine.video_memory[0][published % 64][0] = published;
+
+      writer.publish(machine);
+
+      ++published;
+
+      /*
+       * Give a reader sharing this core a chance to see a whole frame.
+       */
+      std::this_thread::yield();
+    }
+  });
+
+  start = std::chrono::steady_clock::now();
+
+  end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds / 2));
+
+  while (std::chrono::steady_clock::now() < end) {
+    if (reader.read(frame, sequence)) {
+      sequence = frame.sequence;
+
+      ++seen;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  running.store(false, std::memory_order_relaxed);
+
+  producer.join();
+
+  elapsed = std::chrono::steady_clock::now() - start;
+
+  std::printf("concurrent  %14.0f frames/sec published, %.0f read whole\n", published / elapsed.count(), seen / elapsed.count());
+
+  return 0;
+}
+
+static int usage(void) {
+  std::fprintf(stderr, "usage: veranke-reader [--tap key] NAME\n       veranke-reader --benchmark seconds\n");
+
+  return 1;
+}
+
+/*
+ * Watch the display a veranke started with --export NAME publishes,
+ * printing each new frame, and optionally tap one of its keys first.
+ */
+int main(int argc, char **argv) {
+  if (argc == 3 && std::strcmp(argv[1], "--benchmark") == 0) {
+    return benchmark(std::strtod(argv[2], NULL));
+  }
+
+  int tap = -1;
+
+  int i = 1;
+
+  if (argc == 4 && std::strcmp(argv[1], "--tap") == 0) {
+    tap = (int) std::strtol(argv[2], NULL, 16);
+
+    i = 3;
+  }
+
+  if (i != argc - 1) {
+    return usage();
+  }
+
+  SharedSegment segment;
+
+  if (!segment.attach(argv[i])) {
+    std::fprintf(stderr, "veranke-reader: no veranke is exporting %s\n", argv[i]);
+
+    return 1;
+  }
+
+  if (tap >= 0) {
+    segment.push((std::uint8_t) tap, true);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    segment.push((std::uint8_t) tap, false);
+  }
+
+  SharedSegment::Frame frame;
+
+  std::uint64_t sequence = 0;
+
+  for (;;) {
+    if (segment.read(frame, sequence)) {
+      sequence = frame.sequence;
+
+      print(frame);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
@@ -0,0 +1,142 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "veranke.h"
+#include "veranke/sessions.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+static int usage(void) {
+  std::fprintf(stderr, "usage: veranke-sessions [--core switch|table|predecoded|jit|fused] [--threads n] [--sessions n] [--seconds n] [--speed instructions-per-frame] ROM\n");
+
+  return 1;
+}
+
+/*
+ * Host many sessions of one ROM for a while, tapping a key on one session
+ * after another as a crowd of players would, then report how well the
+ * host kept up.
+ */
+int main(int argc, char **argv) {
+  Veranke::Core core = Veranke::PREDECODED;
+
+  std::size_t threads = std::thread::hardware_concurrency();
+
+  std::size_t count = 1000;
+
+  std::size_t seconds = 10;
+
+  std::size_t speed = Scheduler::DEFAULT_INSTRUCTIONS_PER_FRAME;
+
+  int i = 1;
+
+  for (; i < argc - 1; i += 2) {
+    const char * value = argv[i + 1];
+
+    if (std::strcmp(argv[i], "--core") == 0) {
+      if (!Veranke::core_named(value, core)) {
+        return usage();
+      }
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      threads = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--sessions") == 0) {
+      count = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--seconds") == 0) {
+      seconds = (std::size_t) std::strtoull(value, NULL, 10);
+    } else if (std::strcmp(argv[i], "--speed") == 0) {
+      speed = (std::size_t) std::strtoull(value, NULL, 10);
+    } else {
+      return usage();
+    }
+  }
+
+  if (i != argc - 1) {
+    return usage();
+  }
+
+  std::ifstream file(argv[i], std::ios_base::in | std::ios_base::binary);
+
+  if (!file.is_open()) {
+    std::fprintf(stderr, "veranke-sessions: cannot load %s\n", argv[i]);
+
+    return 1;
+  }
+
+  std::vector<char> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  SessionHost host(threads);
+
+  for (std::size_t j = 0; j < count; ++j) {
+    if (!host.spawn((const std::uint8_t *) rom.data(), rom.size(), core, j, speed)) {
+      std::fprintf(stderr, "veranke-sessions: %s does not fit in memory\n", argv[i]);
+
+      return 1;
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+
+  for (std::size_t tap = 0; std::chrono::steady_clock::now() < end; ++tap) {
+    Session &session = host.session(tap % host.size());
+
+    std::uint8_t key = (std::uint8_t) (tap % 16);
+
+    session.press(key);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    session.release(key);
+  }
+
+  std::vector<std::size_t> order(host.size());
+
+  double lag = 0;
+
+  for (std::size_t j = 0; j < host.size(); ++j) {
+    order[j] = j;
+
+    lag += std::chrono::duration<double>(host.session(j).mean_lag()).count();
+  }
+
+  std::sort(order.begin(), order.end(), [&host](std::size_t a, std::size_t b) {
+    return host.session(a).maximum_lag > host.session(b).maximum_lag;
+  });
+
+  std::printf("%zu sessions on %zu threads, %.0f machines per core, %.3f ms mean lag\n", host.size(), host.threads(), host.machines_per_core(), 1000 * lag / host.size());
+
+  for (std::size_t j = 0; j < std::min((std::size_t) 5, order.size()); ++j) {
+    const Session &session = host.session(order[j]);
+
+    std::printf("  session %-6zu %8llu frames, %.3f ms mean lag, %.3f ms worst\n", order[j], (unsigned long long) session.ticks, 1000 * std::chrono::duration<double>(session.mean_lag()).count(), 1000 * std::chrono::duration<double>(session.maximum_lag).count());
+  }
+
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright © 2015 Allen Goodman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS,” WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Differential tests for the interpreter cores: each case runs a short ROM
+ * on every core, and every core must end in the same state as SWITCH, the
+ * reference, and in the state the case expects.
+ */
+
+#include "veranke.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+struct Case {
+  const char * name;
+
+  std::uint8_t rom[16];
+
+  std::size_t size;
+
+  Veranke::Profile profile;
+
+  std::size_t instructions;
+
+  bool (*expect)(const Veranke &veranke);
+};
+
+static bool same(const Veranke &a, const Veranke &b) {
+  return a.memory == b.memory && a.video_memory == b.video_memory && a.registers == b.registers && a.stack == b.stack && a.index == b.index && a.program_counter == b.program_counter && a.stack_pointer == b.stack_pointer && a.waiting == b.waiting && a.random_state == b.random_state;
+}
+
+/*
+ * 0CEE returns like 00EE: the instruction after it never runs.
+ */
+static bool returned(const Veranke &veranke) {
+  return veranke.registers[1] == 1 && veranke.registers[2] == 5 && veranke.registers[3] == 0 && veranke.program_counter == 0x204 && veranke.stack_pointer == 0;
+}
+
+/*
+ * 02FD and 04FD stop the machine like 00FD, and it idles there.
+ */
+static bool exited(const Veranke &veranke) {
+  return veranke.registers[1] == 1 && veranke.registers[2] == 0 && veranke.registers[3] == 0 && veranke.memory[veranke.program_counter + 1] == 0xFD && veranke.fast_forwarded > 0;
+}
+
+/*
+ * CALL with the stack full and RET with it empty halt where they are
+ * rather than write or read past the stack.
+ */
+static bool overflowed(const Veranke &veranke) {
+  return veranke.program_counter == 0x200 && veranke.stack_pointer == 16;
+}
+
+static bool underflowed(const Veranke &veranke) {
+  return veranke.program_counter == 0x200 && veranke.stack_pointer == 0;
+}
+
+static const Case cases[] = {
+  {"non-canonical RET", {0x22, 0x06, 0x61, 0x01, 0x12, 0x04, 0x62, 0x05, 0x0C, 0xEE, 0x63, 0x07, 0x00, 0xEE}, 14, Veranke::MODERN, 64, &returned},
+  {"non-canonical EXIT", {0x61, 0x01, 0x02, 0xFD, 0x62, 0x02}, 6, Veranke::SCHIP, 64, &exited},
+  {"CALL past a full stack", {0x22, 0x00}, 2, Veranke::MODERN, 64, &overflowed},
+  {"RET from an empty stack", {0x00, 0xEE}, 2, Veranke::MODERN, 64, &underflowed},
+  {"non-canonical EXIT at a block's start", {0x61, 0x01, 0x12, 0x06, 0x63, 0x03, 0x04, 0xFD, 0x62, 0x02}, 10, Veranke::SCHIP, 64, &exited},
+};
+
+static bool check(const Case &test) {
+  static const Veranke::Core cores[] = {Veranke::SWITCH, Veranke::TABLE, Veranke::PREDECODED, Veranke::JIT, Veranke::FUSED};
+
+  Veranke reference(Veranke::SWITCH, 0, test.profile);
+
+  bool passed = true;
+
+  for (std::size_t i = 0; i < sizeof(cores) / sizeof(cores[0]); ++i) {
+    Veranke veranke(cores[i], 0, test.profile);
+
+    if (!veranke.load(test.rom, test.size)) {
+      std::printf("FAIL %s: cannot load\n", test.name);
+
+      return false;
+    }
+
+    veranke.run(test.instructions);
+
+    if (i == 0) {
+      reference = veranke;
+    }
+
+    if (!same(veranke, reference) || !test.expect(veranke) || veranke.core != cores[i] || veranke.profile != test.profile) {
+      std::printf("FAIL %s on %s\n", test.name, Veranke::core_name(cores[i]));
+
+      passed = false;
+    }
+  }
+
+  return passed;
+}
+
+/*
+ * restore refuses a state no machine could have saved.
+ */
+static bool check_restore(void) {
+  Veranke veranke;
+
+  MachineState corrupt = veranke.state();
+
+  corrupt.stack_pointer = 17;
+
+  if (veranke.restore(corrupt) || veranke.stack_pointer != 0) {
+    std::printf("FAIL restore of a stack pointer past the stack\n");
+
+    return false;
+  }
+
+  return true;
+}
+
+int main(void) {
+  bool restored = check_restore();
+
+  std::size_t failed = 0;
+
+  for (std::size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    if (!check(cases[i])) {
+      ++failed;
+    }
+  }
+
+  std::printf("%zu of %zu cases passed\n", sizeof(cases) / sizeof(cases[0]) - failed, sizeof(cases) / sizeof(cases[0]));
+
+  return failed == 0 && restored ? 0 : 1;
+}